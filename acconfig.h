@@ -21,3 +21,5 @@
 #undef DEBUG
 
 #undef HAVE_UUID
+
+#undef HAVE_PTHREAD
@@ -19,8 +19,9 @@ int main(int argc, char *argv[]) {
     reiserfs_fs_t *fs;
     reiserfs_dir_t *dir;
     reiserfs_path_node_t *leaf;
-    reiserfs_dir_entry_t entry;
+    reiserfs_dir_plus_t entries[64];
 	
+    uint32_t i, count;
     int32_t offset = 0;
     int error = 0;
 
@@ -60,9 +61,13 @@ int main(int argc, char *argv[]) {
 	goto error_free_dir;
     }
 	
-    while (reiserfs_dir_read(dir, &entry)) {
-	printf("0x%lx 0x%lx \t%s\n", 
-	    get_de_dirid(&entry.de), get_de_objid(&entry.de), entry.de_name);
+    while ((count = reiserfs_dir_read_plus(dir, entries, 64))) {
+	for (i = 0; i < count; i++) {
+	    printf("0x%lx 0x%lx \t%6o %10llu\t%s\n", 
+		get_de_dirid(&entries[i].entry.de), get_de_objid(&entries[i].entry.de), 
+		entries[i].stat.st_mode, (unsigned long long)entries[i].stat.st_size, 
+		entries[i].entry.de_name);
+	}
     }
 
     reiserfs_dir_close(dir);
@@ -9,6 +9,13 @@
 #include <dal/dal.h>
 #include "filesystem.h"
 
+/* Count of blocks described by one free space summary group */
+#define BITMAP_GROUP_BITS	(4096 * 8)
+
+/* Bitmap open flags */
+#define BITMAP_LAZY		(1 << 0)
+#define BITMAP_COMPRESSED	(1 << 1)
+
 typedef int (reiserfs_bitmap_pipe_func_t)(dal_t *, blk_t, char *, uint32_t, void *);
 
 extern void reiserfs_bitmap_use_block(reiserfs_bitmap_t *bitmap, blk_t blk);
@@ -16,6 +23,18 @@ extern void reiserfs_bitmap_unuse_block(reiserfs_bitmap_t *bitmap, blk_t blk);
 extern int reiserfs_bitmap_test_block(reiserfs_bitmap_t *bitmap, blk_t blk);
 extern blk_t reiserfs_bitmap_find_free(reiserfs_bitmap_t *bitmap, blk_t start);
 
+extern void reiserfs_bitmap_use_range(reiserfs_bitmap_t *bitmap, 
+    blk_t start, count_t count);
+
+extern void reiserfs_bitmap_unuse_range(reiserfs_bitmap_t *bitmap, 
+    blk_t start, count_t count);
+
+extern blk_t reiserfs_bitmap_find_free_extent(reiserfs_bitmap_t *bitmap, 
+    blk_t goal, count_t min_len, count_t max_len, count_t *len);
+
+extern count_t reiserfs_bitmap_largest_free(reiserfs_bitmap_t *bitmap, 
+    blk_t *start);
+
 extern blk_t reiserfs_bitmap_calc_used(reiserfs_bitmap_t *bitmap);
 extern blk_t reiserfs_bitmap_calc_unused(reiserfs_bitmap_t *bitmap);
 
@@ -35,6 +54,9 @@ extern reiserfs_bitmap_t *reiserfs_bitmap_alloc(count_t len);
 extern reiserfs_bitmap_t *reiserfs_bitmap_open(reiserfs_fs_t *fs, 
     blk_t start, count_t len);
 
+extern reiserfs_bitmap_t *reiserfs_bitmap_open_as(reiserfs_fs_t *fs, 
+    blk_t start, count_t len, int flags);
+
 extern reiserfs_bitmap_t *reiserfs_bitmap_create(reiserfs_fs_t *fs, 
     blk_t start, count_t len);
 
@@ -16,6 +16,7 @@
 #include "journal.h"
 #include "gauge.h"
 #include "filesystem.h"
+#include "object.h"
 
 #define FS_CLEAN					1
 #define FS_DIRTY					2
@@ -26,6 +27,21 @@
 #define FS_SUPER_DIRTY					(1)
 #define FS_BITMAP_DIRTY					(1 << 1)
 #define FS_JOURNAL_DIRTY				(1 << 2)
+#define FS_JOURNAL_OVERLAY				(1 << 3)
+
+/* Item types of full volume scan */
+#define FS_SCAN_SD					(1 << KEY_TYPE_SD)
+#define FS_SCAN_IT					(1 << KEY_TYPE_IT)
+#define FS_SCAN_DT					(1 << KEY_TYPE_DT)
+#define FS_SCAN_DR					(1 << KEY_TYPE_DR)
+#define FS_SCAN_ALL					(FS_SCAN_SD | FS_SCAN_IT | \
+							FS_SCAN_DT | FS_SCAN_DR)
+
+/* Max number of adjacent leaves read at once by full volume scan */
+#define FS_SCAN_RUN_MAX					64
+
+typedef int (*reiserfs_fs_scan_func_t)(reiserfs_block_t *leaf, 
+    reiserfs_item_head_t *item, void *body, void *data);
 
 #define SUPER_V1_SIZE					(sizeof(reiserfs_super_v1_t))
 #define SUPER_V2_SIZE					(sizeof(reiserfs_super_t))
@@ -82,6 +98,7 @@
 #define reiserfs_fs_super_dirty(fs)			(FS_SUPER_DIRTY & fs->flags)
 #define reiserfs_fs_bitmap_dirty(fs)			(FS_BITMAP_DIRTY & fs->flags)
 #define reiserfs_fs_journal_dirty(fs)			(FS_JOURNAL_DIRTY & fs->flags)
+#define reiserfs_fs_journal_overlay(fs)			(FS_JOURNAL_OVERLAY & fs->flags)
 
 #define reiserfs_fs_mark_super_dirty(fs)		(fs->flags |= FS_SUPER_DIRTY)
 #define reiserfs_fs_mark_bitmap_dirty(fs)		(fs->flags |= FS_BITMAP_DIRTY)
@@ -99,6 +116,9 @@ extern blk_t reiserfs_fs_probe(dal_t *dal);
 
 extern reiserfs_fs_t *reiserfs_fs_open(dal_t *host_dal, dal_t *journal_dal);
 extern reiserfs_fs_t *reiserfs_fs_open_fast(dal_t *host_dal, dal_t *journal_dal);
+extern reiserfs_fs_t *reiserfs_fs_open_lazy(dal_t *host_dal, dal_t *journal_dal);
+extern reiserfs_fs_t *reiserfs_fs_open_compressed(dal_t *host_dal, dal_t *journal_dal);
+extern reiserfs_fs_t *reiserfs_fs_open_overlay(dal_t *host_dal, dal_t *journal_dal);
 
 extern reiserfs_fs_t *reiserfs_fs_create(dal_t *host_dal, dal_t *journal_dal, 
     blk_t start, blk_t max_trans, blk_t len, size_t blocksize, int format, 
@@ -148,6 +168,9 @@ extern char *reiserfs_fs_uuid(reiserfs_fs_t *fs);
 extern void reiserfs_fs_uuid_update(reiserfs_fs_t *fs, const char *uuid);
 
 extern int reiserfs_fs_set_root(reiserfs_fs_t *fs, blk_t blk);
+
+extern int reiserfs_fs_scan_items(reiserfs_fs_t *fs, uint32_t type_mask, 
+    reiserfs_fs_scan_func_t scan_func, void *data);
 extern dal_t *reiserfs_fs_host_dal(reiserfs_fs_t *fs);
 
 extern void *reiserfs_fs_get_data(reiserfs_fs_t *fs);
@@ -183,11 +206,16 @@ extern int reiserfs_fs_journal_tune(reiserfs_fs_t *fs, dal_t *dal,
 extern int reiserfs_fs_bitmap_opened(reiserfs_fs_t *fs);
 extern void reiserfs_fs_bitmap_use_block(reiserfs_fs_t *fs, blk_t block);
 extern void reiserfs_fs_bitmap_unuse_block(reiserfs_fs_t *fs, blk_t block);
+extern void reiserfs_fs_bitmap_use_range(reiserfs_fs_t *fs, blk_t start, count_t count);
+extern void reiserfs_fs_bitmap_unuse_range(reiserfs_fs_t *fs, blk_t start, count_t count);
 extern int reiserfs_fs_bitmap_test_block(reiserfs_fs_t *fs, blk_t block);
 
 extern blk_t reiserfs_fs_bitmap_find_free_block(reiserfs_fs_t *fs, 
     blk_t start);
 
+extern blk_t reiserfs_fs_bitmap_find_free_extent(reiserfs_fs_t *fs, blk_t goal, 
+    count_t min_len, count_t max_len, count_t *len);
+
 extern blk_t reiserfs_fs_bitmap_calc_used(reiserfs_fs_t *fs);
 extern blk_t reiserfs_fs_bitmap_calc_used(reiserfs_fs_t *fs);
 extern blk_t reiserfs_fs_bitmap_used(reiserfs_fs_t *fs);
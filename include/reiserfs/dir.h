@@ -68,9 +68,64 @@ struct reiserfs_dir_entry {
 
 typedef struct reiserfs_dir_entry reiserfs_dir_entry_t;
 
+/* Record of batched dir reading, records are aligned by 8 bytes */
+struct reiserfs_dirent {
+    uint32_t d_dirid;
+    uint32_t d_objid;
+    uint32_t d_offset;
+    uint16_t d_reclen;
+    uint16_t d_namelen;
+    char d_name[];
+};
+
+typedef struct reiserfs_dirent reiserfs_dirent_t;
+
+/* Size of the record of the longest name, batch buffer should fit it */
+#define DIRENT_MAX_SIZE(blocksize) \
+	ROUND_UP(sizeof(reiserfs_dirent_t) + MAX_NAME_LEN(blocksize) + 1)
+
+struct reiserfs_dir_plus {
+    reiserfs_dir_entry_t entry;
+    struct stat stat;
+};
+
+typedef struct reiserfs_dir_plus reiserfs_dir_plus_t;
+
+/* Dir walking */
+#define DIR_WALK_ORDERED		(1 << 0)
+
+#define DIR_WALK_THREADS		4
+#define DIR_WALK_BATCH			64
+#define DIR_WALK_AHEAD			64
+
+struct reiserfs_dir_walk_entry {
+    const char *path;
+	
+    /* Offset of the name inside path and depth from the walk root */
+    uint32_t base;
+    uint32_t level;
+	
+    uint32_t dirid;
+    uint32_t objid;
+	
+    struct stat stat;
+};
+
+typedef struct reiserfs_dir_walk_entry reiserfs_dir_walk_entry_t;
+
+typedef int (*reiserfs_dir_walk_func_t)(reiserfs_dir_walk_entry_t *entry, void *data);
+
 extern reiserfs_dir_t *reiserfs_dir_open(reiserfs_fs_t *fs, 
     const char *name);
 
+extern reiserfs_dir_t *reiserfs_dir_open_at(reiserfs_fs_t *fs, 
+    struct key *dirkey, const char *name);
+
+extern reiserfs_dir_t *reiserfs_dir_open_by_key(reiserfs_fs_t *fs, 
+    uint32_t dirid, uint32_t objid);
+
+extern struct key *reiserfs_dir_key(reiserfs_dir_t *dir);
+
 extern void reiserfs_dir_close(reiserfs_dir_t *dir);
 extern int reiserfs_dir_rewind(reiserfs_dir_t *dir);
 extern int reiserfs_dir_seek(reiserfs_dir_t *dir, uint32_t offset);
@@ -80,6 +135,12 @@ extern uint32_t reiserfs_dir_offset(reiserfs_dir_t *dir);
 extern int reiserfs_dir_read(reiserfs_dir_t *dir, 
     reiserfs_dir_entry_t *entry);
 
+extern uint32_t reiserfs_dir_read_batch(reiserfs_dir_t *dir, 
+    void *buffer, uint32_t size);
+
+extern uint32_t reiserfs_dir_read_plus(reiserfs_dir_t *dir, 
+    reiserfs_dir_plus_t *entries, uint32_t count);
+
 extern int reiserfs_dir_find_key(reiserfs_dir_t *dir, uint32_t entry_hash, 
     struct key *key);
 
@@ -87,5 +148,8 @@ extern int reiserfs_dir_stat(reiserfs_dir_t *dir, struct stat *stat);
 
 extern int reiserfs_dir_entry_hidden(reiserfs_dir_entry_t *entry);
 
+extern int reiserfs_dir_walk(reiserfs_fs_t *fs, const char *root, 
+    int flags, reiserfs_dir_walk_func_t walk_func, void *data);
+
 #endif
 
@@ -14,11 +14,42 @@
     ((blocksize) - NDHD_SIZE - 2*IH_SIZE \
     - SD_V1_SIZE - sizeof(uint32_t))
 
+/* Max blocks of a contiguous run read by one request */
+#define FILE_READ_RUN_MAX	1024
+
+/* Parallel read: default workers and blocks taken by a worker at once */
+#define FILE_READ_THREADS	4
+#define FILE_READ_SLICE		256
+
+/* 
+    Extent map of the file. It is built on the first access by walking the 
+    file items once and maps byte ranges to runs of unformatted blocks, to 
+    direct item bodies or to holes.
+*/
+#define FILE_EXTENT_HOLE	0
+#define FILE_EXTENT_BLOCKS	1
+#define FILE_EXTENT_DIRECT	2
+
+struct reiserfs_file_extent {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t type;
+
+    /* First block of the run or the leaf the direct item lies in */
+    blk_t start;
+
+    /* Direct item body location inside the leaf */
+    uint32_t body;
+};
+
+typedef struct reiserfs_file_extent reiserfs_file_extent_t;
+
 struct reiserfs_file {
     reiserfs_object_t *entity;
 	
-    uint32_t offset_it;
-    uint64_t offset_dt;
+    reiserfs_file_extent_t *extents;
+    uint32_t extents_count;
+    uint32_t extents_max;
 	
     uint64_t size;
     uint64_t offset;
@@ -32,17 +63,41 @@ extern reiserfs_file_t *reiserfs_file_open(reiserfs_fs_t *fs,
 extern reiserfs_file_t *reiserfs_link_open(reiserfs_fs_t *fs, 
     const char *name, int mode);
 
+extern reiserfs_file_t *reiserfs_file_open_at(reiserfs_fs_t *fs, 
+    struct key *dirkey, const char *name, int mode);
+
+extern reiserfs_file_t *reiserfs_link_open_at(reiserfs_fs_t *fs, 
+    struct key *dirkey, const char *name, int mode);
+
+extern reiserfs_file_t *reiserfs_file_open_by_key(reiserfs_fs_t *fs, 
+    uint32_t dirid, uint32_t objid, int mode);
+
 extern void reiserfs_file_close(reiserfs_file_t *file);
 
 extern uint64_t reiserfs_file_read(reiserfs_file_t *file, 
     void *buffer, uint64_t size);
 
+extern uint64_t reiserfs_file_pread(reiserfs_file_t *file, 
+    void *buffer, uint64_t size, uint64_t offset);
+
+extern uint64_t reiserfs_file_pread_parallel(reiserfs_file_t *file, 
+    void *buffer, uint64_t size, uint64_t offset, uint32_t threads);
+
 extern uint64_t reiserfs_file_size(reiserfs_file_t *file);
 extern uint64_t reiserfs_file_offset(reiserfs_file_t *file);
 
 extern int reiserfs_file_seek(reiserfs_file_t *file, 
     uint64_t offset);
 
+extern int reiserfs_file_seek_data(reiserfs_file_t *file, 
+    uint64_t offset);
+
+extern int reiserfs_file_seek_hole(reiserfs_file_t *file, 
+    uint64_t offset);
+
+extern uint32_t reiserfs_file_extents(reiserfs_file_t *file, 
+    uint64_t offset, reiserfs_file_extent_t *extents, uint32_t count);
+
 extern int reiserfs_file_rewind(reiserfs_file_t *file);
 
 extern int reiserfs_file_stat(reiserfs_file_t *file, 
@@ -89,17 +89,36 @@ struct reiserfs_journal_head {
 
 typedef struct reiserfs_journal_head reiserfs_journal_head_t;
 
+/* 
+    Index of unflushed transactions: hash of (realblock, journal block) 
+    pairs, holding the newest logged copy of every block.
+*/
 struct reiserfs_journal_cashe {
     uint32_t trans_nr;
     uint32_t *blocks;
+    uint32_t size, count;
+
+    /* The newest indexed transaction and journal offset after it */
+    uint32_t trans_id, offset;
 };
 
 typedef struct reiserfs_journal_cashe reiserfs_journal_cashe_t;
 
+/* Blocks logged by not yet written transaction and its logical operations */
+struct reiserfs_journal_batch {
+    dal_t *host;
+    uint32_t refs, start;
+    uint32_t count;
+    void **blocks;
+};
+
+typedef struct reiserfs_journal_batch reiserfs_journal_batch_t;
+
 struct reiserfs_journal {
     dal_t *dal;
     reiserfs_journal_head_t head;
     reiserfs_journal_cashe_t cashe;
+    reiserfs_journal_batch_t batch;
 };
 
 typedef struct reiserfs_journal reiserfs_journal_t;
@@ -146,6 +165,14 @@ struct reiserfs_object {
 
 typedef struct reiserfs_object reiserfs_object_t;
 
+/* Free runs of a bitmap group: free head and tail and the longest one */
+struct reiserfs_bitmap_span {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t longest;
+    uint32_t offset;
+};
+
 /* Bitmap */
 struct reiserfs_bitmap {
     reiserfs_fs_t *fs;
@@ -156,6 +183,31 @@ struct reiserfs_bitmap {
     
     char *map;
     uint32_t size;
+
+    /* Free space summary: free blocks per group and a mask of non-full words */
+    uint32_t *group_free;
+    uint32_t groups;
+    char *nonfull;
+
+    /* Upper level: groups having free blocks and free runs of each group */
+    char *free_groups;
+    struct reiserfs_bitmap_span *spans;
+
+    /* Groups which spans are to be recounted */
+    char *stale;
+
+    /* Groups changed since the last sync */
+    char *dirty;
+
+    /* Groups fetched from disk, NULL when the whole map is in memory */
+    char *loaded;
+    int flags;
+
+    /* Per group parts of the map if compressed, NULL for uniform groups */
+    char **chunks;
+
+    /* Groups of compressed bitmap which chunks are run containers */
+    char *packed;
 };
 
 typedef struct reiserfs_bitmap reiserfs_bitmap_t;
@@ -180,6 +232,10 @@ struct reiserfs_fs {
     blk_t super_off;
     uint16_t flags;
     void *data;
+
+    /* Dentry and stat data caches, see object.c */
+    struct reiserfs_dcache *dcache;
+    struct reiserfs_scache *scache;
 };
 
 #endif
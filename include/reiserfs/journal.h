@@ -26,6 +26,9 @@
 #define JOURNAL_MAX_BATCH   			900
 #define JOURNAL_NEED_TUNE 			0xffffffff
 
+/* Blocks kept by sequential journal scanner */
+#define JOURNAL_SCAN_RING 			1024
+
 #define JOURNAL_MAX_COMMIT_AGE 			30 
 #define JOURNAL_MAX_TRANS_AGE 			30
 
@@ -114,6 +117,15 @@ extern blk_t reiserfs_journal_boundary_transactions(reiserfs_journal_t *journal,
     reiserfs_journal_trans_t *oldest, reiserfs_journal_trans_t *newest);
 
 extern reiserfs_block_t *reiserfs_journal_read(reiserfs_journal_t *journal, blk_t blk);
+extern int reiserfs_journal_replay(reiserfs_journal_t *journal, dal_t *dal);
+
+extern int reiserfs_journal_begin(reiserfs_journal_t *journal, dal_t *host);
+extern int reiserfs_journal_log(reiserfs_journal_t *journal, reiserfs_block_t *block);
+extern int reiserfs_journal_commit(reiserfs_journal_t *journal);
+extern int reiserfs_journal_flush(reiserfs_journal_t *journal);
+
+extern dal_t *reiserfs_journal_overlay_open(reiserfs_journal_t *journal, dal_t *host);
+extern void reiserfs_journal_overlay_close(dal_t *dal);
 
 #endif
 
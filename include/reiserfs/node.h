@@ -47,6 +47,9 @@ typedef struct reiserfs_node_head reiserfs_node_head_t;
 #define get_node_free_space(node) 		get_le16(node, nh_free_space)
 #define set_node_free_space(node, val)		set_le16(node, nh_free_space, val)
 
+#define get_node_key(bh, pos) \
+	((struct key *)((bh)->data + NDHD_SIZE) + (pos))
+
 #define get_node_disk_child(bh, pos) \
 	((reiserfs_disk_child_t *)((bh)->data + NDHD_SIZE + \
 	get_node_nritems((reiserfs_node_head_t *)(bh)->data) * \
@@ -157,17 +157,71 @@ typedef struct reiserfs_sd_v2 reiserfs_sd_v2_t;
 
 #define PATH_SEPARATOR			'/'
 
+/*
+    Ext2/linux mode flags. We define them here so that we don't need to depend on 
+    the OS's sys/stat.h, since we may be compiling on a non-Linux system.
+*/
+#define LINUX_S_IFMT	    00170000
+#define LINUX_S_IFSOCK	    0140000
+#define LINUX_S_IFLNK	    0120000
+#define LINUX_S_IFREG	    0100000
+#define LINUX_S_IFBLK	    0060000
+#define LINUX_S_IFDIR	    0040000
+#define LINUX_S_IFCHR	    0020000
+#define LINUX_S_IFIFO	    0010000
+#define LINUX_S_ISUID	    0004000
+#define LINUX_S_ISGID	    0002000
+#define LINUX_S_ISVTX	    0001000
+
+#define LINUX_S_IRWXU	    00700
+#define LINUX_S_IRUSR	    00400
+#define LINUX_S_IWUSR	    00200
+#define LINUX_S_IXUSR	    00100
+
+#define LINUX_S_IRWXG	    00070
+#define LINUX_S_IRGRP	    00040
+#define LINUX_S_IWGRP	    00020
+#define LINUX_S_IXGRP	    00010
+
+#define LINUX_S_IRWXO	    00007
+#define LINUX_S_IROTH	    00004
+#define LINUX_S_IWOTH	    00002
+#define LINUX_S_IXOTH	    00001
+
+#define LINUX_S_ISLNK(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFLNK)
+#define LINUX_S_ISREG(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFREG)
+#define LINUX_S_ISDIR(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFDIR)
+#define LINUX_S_ISCHR(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFCHR)
+#define LINUX_S_ISBLK(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFBLK)
+#define LINUX_S_ISFIFO(m)   (((m) & LINUX_S_IFMT) == LINUX_S_IFIFO)
+#define LINUX_S_ISSOCK(m)   (((m) & LINUX_S_IFMT) == LINUX_S_IFSOCK)
+
+/* Dentry cache: max entries and hash table size */
+#define OBJECT_DCACHE_MAX		4096
+#define OBJECT_DCACHE_SIZE		1024
+
+#define OBJECT_SCACHE_LIMIT		(1024 * 1024)
+#define OBJECT_SCACHE_SIZE		1024
+
 extern int reiserfs_object_test(reiserfs_fs_t *fs, uint32_t objectid);
 extern int reiserfs_object_use(reiserfs_fs_t *fs, uint32_t objectid);
 
 extern int reiserfs_object_find_stat(reiserfs_object_t *object);
 
+extern void reiserfs_object_fill_stat(reiserfs_fs_t *fs, reiserfs_item_head_t *item, 
+    void *sd, struct stat *stat);
+
 extern int reiserfs_object_find_entry(reiserfs_path_node_t *leaf, 
     uint32_t entry_hash, struct key *entry_key);
 
 extern int reiserfs_object_find_path(reiserfs_object_t *object, 
     const char *name, struct key *dirkey, int as_link);
 
+extern void reiserfs_object_dcache_invalidate(reiserfs_fs_t *fs, 
+    struct key *dirkey);
+
+extern void reiserfs_object_scache_invalidate(reiserfs_fs_t *fs, blk_t blk);
+
 extern reiserfs_path_node_t *reiserfs_object_seek_by_offset(
     reiserfs_object_t *object, uint64_t offset, uint64_t type, 
     reiserfs_comp_func_t comp_func);
@@ -175,6 +229,12 @@ extern reiserfs_path_node_t *reiserfs_object_seek_by_offset(
 extern reiserfs_object_t *reiserfs_object_create(reiserfs_fs_t *fs, 
     const char *name, int as_link);
 
+extern reiserfs_object_t *reiserfs_object_create_at(reiserfs_fs_t *fs, 
+    struct key *dirkey, const char *name, int as_link);
+
+extern reiserfs_object_t *reiserfs_object_create_by_key(reiserfs_fs_t *fs, 
+    struct key *key);
+
 extern void reiserfs_object_free(reiserfs_object_t *object);
 
 extern int reiserfs_object_is_reg(reiserfs_object_t *object);
@@ -24,6 +24,24 @@ extern int reiserfs_tools_find_first_zero_bit(
 extern int reiserfs_tools_find_next_zero_bit(
     const void *vaddr, unsigned size, unsigned offset);
 
+extern unsigned long reiserfs_tools_find_next_zero(const void *vaddr, 
+    unsigned long size, unsigned long offset);
+
+extern unsigned long reiserfs_tools_find_next_set(const void *vaddr, 
+    unsigned long size, unsigned long offset);
+
+extern unsigned long reiserfs_tools_count_bits(const void *vaddr, 
+    unsigned long start, unsigned long end);
+
+extern void reiserfs_tools_set_bits(void *vaddr, 
+    unsigned long start, unsigned long end);
+
+extern void reiserfs_tools_clear_bits(void *vaddr, 
+    unsigned long start, unsigned long end);
+
+extern int reiserfs_tools_comp_bits(const void *vaddr1, const void *vaddr2, 
+    unsigned long start, unsigned long end);
+
 #define REISERFS_3_5_SUPER_SIGNATURE "ReIsErFs"
 #define REISERFS_3_6_SUPER_SIGNATURE "ReIsEr2Fs"
 #define REISERFS_JR_SUPER_SIGNATURE  "ReIsEr3Fs"
@@ -25,6 +25,23 @@
 
 #define MAX_HEIGHT 		5
 
+/* 
+    Key range size estimation. Without exact flag only internal nodes are read
+    and leaf sizes are taken from disk_child dc_size fields. Leaves which lie 
+    on the range boundaries are counted by half and item count is derived 
+    from the stat data item size.
+*/
+#define ESTIMATE_ITEM_SIZE	(IH_SIZE + SD_V2_SIZE)
+
+struct reiserfs_tree_estimate {
+    count_t internals;
+    count_t leaves;
+    count_t items;
+    uint64_t bytes;
+};
+
+typedef struct reiserfs_tree_estimate reiserfs_tree_estimate_t;
+
 typedef long (*reiserfs_node_func_t)(reiserfs_block_t *node, void *data);
 
 typedef long (*reiserfs_chld_func_t)(reiserfs_block_t *node, uint32_t chld, 
@@ -42,6 +59,15 @@ extern reiserfs_path_node_t *reiserfs_tree_lookup_internal(reiserfs_tree_t *tree
 extern reiserfs_path_node_t *reiserfs_tree_lookup_leaf(reiserfs_tree_t *tree, 
     blk_t from, reiserfs_comp_func_t comp_func, struct key *key, reiserfs_path_t *path);
 
+extern reiserfs_path_node_t *reiserfs_tree_lookup_near(reiserfs_tree_t *tree, 
+    reiserfs_comp_func_t comp_func, struct key *key, reiserfs_path_t *path);
+
+extern struct key *reiserfs_tree_left_key(reiserfs_path_t *path);
+extern struct key *reiserfs_tree_right_key(reiserfs_path_t *path);
+
+extern reiserfs_path_node_t *reiserfs_tree_next_leaf(reiserfs_tree_t *tree, 
+    reiserfs_path_t *path);
+
 extern long reiserfs_tree_traverse(reiserfs_tree_t *tree, void *data,
     reiserfs_edge_traverse_func_t before_node_func, reiserfs_node_func_t node_func,
     reiserfs_chld_func_t chld_func, reiserfs_edge_traverse_func_t after_node_func);
@@ -49,6 +75,15 @@ extern long reiserfs_tree_traverse(reiserfs_tree_t *tree, void *data,
 extern long reiserfs_tree_simple_traverse(reiserfs_tree_t *tree, void *data,
     reiserfs_node_func_t node_func);
 
+extern int reiserfs_tree_estimate(reiserfs_tree_t *tree, struct key *start, 
+    struct key *end, int exact, reiserfs_tree_estimate_t *estimate);
+
+extern int reiserfs_tree_estimate_dirid(reiserfs_tree_t *tree, uint32_t dirid, 
+    int exact, reiserfs_tree_estimate_t *estimate);
+
+extern int reiserfs_tree_leaves(reiserfs_tree_t *tree, blk_t **leaves, 
+    uint32_t *count);
+
 extern void reiserfs_tree_set_offset(reiserfs_tree_t *tree, long offset);
 extern long reiserfs_tree_get_offset(reiserfs_tree_t *tree);
 
@@ -38,16 +38,25 @@ static int file_read(dal_t *dal, void *buff, blk_t block, count_t count) {
     	return 0;
 	
     off = (off_t)block * (off_t)dal->blocksize;
+    len = (off_t)(count * dal->blocksize);
+
+#ifndef DJGPP
+    /* Descriptor offset is not used, so concurrent readers don't race */
+    if (pread(*((int *)dal->entity), buff, len, off) <= 0) {
+	file_save_error(dal);
+	return 0;
+    }
+#else
     if (lseek(*((int *)dal->entity), off, SEEK_SET) == (off_t)-1) {
 	file_save_error(dal);
 	return 0;
     }
 
-    len = (off_t)(count * dal->blocksize);
     if (read(*((int *)dal->entity), buff, len) <= 0) {
 	file_save_error(dal);
 	return 0;
     }
+#endif
     
     return 1;
 }
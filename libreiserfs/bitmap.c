@@ -19,79 +19,944 @@
 	} \
     } while (0); \
 	
+/* Run container of compressed bitmap's group, sorted used extents */
+#define BITMAP_RUNS_MAX 64
+
+struct reiserfs_bitmap_runs {
+    uint32_t count;
+    struct {
+	uint16_t start;
+	uint16_t last;
+    } run[1];
+};
+
+
+/* 
+    Free space summary. Each group of BITMAP_GROUP_BITS blocks keeps its free
+    blocks count and every 64-bit word of the map has a bit in nonfull mask,
+    which is set while the word has at least one free block. Upper level has
+    a bit per group in free_groups, set while the group has free blocks, so 
+    full groups are skipped without visiting them. Each group also keeps its 
+    span (free head, tail and longest run), recounted only for stale groups.
+*/
+static blk_t reiserfs_bitmap_group_len(reiserfs_bitmap_t *bitmap, blk_t group) {
+    blk_t start = group * BITMAP_GROUP_BITS;
+
+    return (bitmap->total_blocks - start < BITMAP_GROUP_BITS ? 
+	bitmap->total_blocks - start : BITMAP_GROUP_BITS);
+}
+
+/* 
+    Returns the part of the map given group is described by. Compressed 
+    bitmap keeps no memory for groups which are all free or all used, so 
+    NULL is returned for them and their state is told by the free counter.
+    Groups with a few used extents are kept as run containers there.
+*/
+static char *reiserfs_bitmap_chunk(reiserfs_bitmap_t *bitmap, blk_t group) {
+    if (bitmap->chunks)
+	return bitmap->chunks[group];
+    
+    return bitmap->map + group * (BITMAP_GROUP_BITS / 8);
+}
+
+static int reiserfs_bitmap_packed(reiserfs_bitmap_t *bitmap, blk_t group) {
+    return bitmap->chunks && reiserfs_tools_test_bit(group, bitmap->packed);
+}
+
+/* Index of the first run which ends at given bit or after it */
+static uint32_t reiserfs_bitmap_runs_find(struct reiserfs_bitmap_runs *runs, 
+    blk_t bit) 
+{
+    uint32_t left = 0, right = runs->count, mid;
+
+    while (left < right) {
+	mid = (left + right) / 2;
+	
+	if (runs->run[mid].last < bit)
+	    left = mid + 1;
+	else
+	    right = mid;
+    }
+
+    return left;
+}
+
+/* The same as chunk, but the group gets plain chunk which may be changed */
+static char *reiserfs_bitmap_chunk_get(reiserfs_bitmap_t *bitmap, blk_t group) {
+    uint32_t i;
+    char *chunk, *bits;
+    struct reiserfs_bitmap_runs *runs;
+
+    if ((chunk = reiserfs_bitmap_chunk(bitmap, group)) && 
+	    !reiserfs_bitmap_packed(bitmap, group))
+	return chunk;
+
+    if (!(bits = libreiserfs_calloc(BITMAP_GROUP_BITS / 8, 
+	    chunk || bitmap->group_free[group] ? 0 : 0xff)))
+	return NULL;
+
+    if (chunk) {
+	runs = (struct reiserfs_bitmap_runs *)chunk;
+	
+	for (i = 0; i < runs->count; i++)
+	    reiserfs_tools_set_bits(bits, runs->run[i].start, runs->run[i].last + 1);
+
+	libreiserfs_free(chunk);
+	reiserfs_tools_clear_bit(group, bitmap->packed);
+    }
+    
+    return (bitmap->chunks[group] = bits);
+}
+
+/* Drops the chunk of compressed bitmap's group when it became uniform */
+static void reiserfs_bitmap_chunk_put(reiserfs_bitmap_t *bitmap, blk_t group) {
+    if (!bitmap->chunks || !bitmap->chunks[group])
+	return;
+
+    if (bitmap->group_free[group] && bitmap->group_free[group] != 
+	    reiserfs_bitmap_group_len(bitmap, group))
+	return;
+
+    libreiserfs_free(bitmap->chunks[group]);
+    bitmap->chunks[group] = NULL;
+    reiserfs_tools_clear_bit(group, bitmap->packed);
+}
+
+/* Turns plain chunk of compressed bitmap into run container if it is sparse */
+static void reiserfs_bitmap_chunk_pack(reiserfs_bitmap_t *bitmap, blk_t group) {
+    char *chunk;
+    uint32_t count = 0;
+    blk_t blk, end, len;
+    struct reiserfs_bitmap_runs *runs;
+
+    reiserfs_bitmap_chunk_put(bitmap, group);
+    
+    if (!bitmap->chunks || !(chunk = bitmap->chunks[group]) || 
+	    reiserfs_bitmap_packed(bitmap, group))
+	return;
+
+    len = reiserfs_bitmap_group_len(bitmap, group);
+    
+    for (blk = reiserfs_tools_find_next_set(chunk, len, 0); blk < len; 
+	blk = reiserfs_tools_find_next_set(chunk, len, end)) 
+    {
+	if (++count > BITMAP_RUNS_MAX)
+	    return;
+	
+	end = reiserfs_tools_find_next_zero(chunk, len, blk);
+    }
+
+    if (!(runs = libreiserfs_calloc(sizeof(*runs) + 
+	    (count - 1) * sizeof(runs->run[0]), 0)))
+	return;
+
+    for (blk = reiserfs_tools_find_next_set(chunk, len, 0); blk < len; 
+	blk = reiserfs_tools_find_next_set(chunk, len, end)) 
+    {
+	if ((end = reiserfs_tools_find_next_zero(chunk, len, blk)) > len)
+	    end = len;
+	
+	runs->run[runs->count].start = blk;
+	runs->run[runs->count++].last = end - 1;
+    }
+
+    libreiserfs_free(chunk);
+    
+    bitmap->chunks[group] = (char *)runs;
+    reiserfs_tools_set_bit(group, bitmap->packed);
+}
+
+/* Group local bit test, search and count which know about all chunk kinds */
+static int reiserfs_bitmap_group_test(reiserfs_bitmap_t *bitmap, 
+    blk_t group, blk_t bit) 
+{
+    uint32_t i;
+    char *chunk;
+    struct reiserfs_bitmap_runs *runs;
+    
+    if (!(chunk = reiserfs_bitmap_chunk(bitmap, group)))
+	return bitmap->group_free[group] == 0;
+
+    if (!reiserfs_bitmap_packed(bitmap, group))
+	return reiserfs_tools_test_bit(bit, chunk);
+    
+    runs = (struct reiserfs_bitmap_runs *)chunk;
+    i = reiserfs_bitmap_runs_find(runs, bit);
+	
+    return i < runs->count && runs->run[i].start <= bit;
+}
+
+static blk_t reiserfs_bitmap_group_next(reiserfs_bitmap_t *bitmap, 
+    blk_t group, blk_t from, blk_t limit, int used) 
+{
+    uint32_t i;
+    char *chunk;
+    struct reiserfs_bitmap_runs *runs;
+
+    if (from >= limit)
+	return limit;
+    
+    if (!(chunk = reiserfs_bitmap_chunk(bitmap, group)))
+	return (!bitmap->group_free[group] == !!used) ? from : limit;
+
+    if (!reiserfs_bitmap_packed(bitmap, group)) {
+	from = (used ? reiserfs_tools_find_next_set(chunk, limit, from) : 
+	    reiserfs_tools_find_next_zero(chunk, limit, from));
+	
+	return from < limit ? from : limit;
+    }
+    
+    runs = (struct reiserfs_bitmap_runs *)chunk;
+    i = reiserfs_bitmap_runs_find(runs, from);
+
+    if (used) {
+	if (i >= runs->count)
+	    return limit;
+	
+	if (runs->run[i].start > from)
+	    from = runs->run[i].start;
+    } else if (i < runs->count && runs->run[i].start <= from)
+	from = runs->run[i].last + 1;
+
+    return from < limit ? from : limit;
+}
+
+static blk_t reiserfs_bitmap_group_count(reiserfs_bitmap_t *bitmap, 
+    blk_t group, blk_t from, blk_t to) 
+{
+    uint32_t i;
+    char *chunk;
+    blk_t used = 0;
+    struct reiserfs_bitmap_runs *runs;
+
+    if (!(chunk = reiserfs_bitmap_chunk(bitmap, group)))
+	return bitmap->group_free[group] ? 0 : to - from;
+
+    if (!reiserfs_bitmap_packed(bitmap, group))
+	return reiserfs_tools_count_bits(chunk, from, to);
+    
+    runs = (struct reiserfs_bitmap_runs *)chunk;
+    
+    for (i = reiserfs_bitmap_runs_find(runs, from); 
+	i < runs->count && runs->run[i].start < to; i++)
+    {
+	blk_t start = runs->run[i].start, end = (blk_t)runs->run[i].last + 1;
+	
+	used += (end < to ? end : to) - (start > from ? start : from);
+    }
+
+    return used;
+}
+
+static int reiserfs_bitmap_word_full(reiserfs_bitmap_t *bitmap, blk_t word) {
+    blk_t group, start, limit;
+
+    group = (word << 6) / BITMAP_GROUP_BITS;
+    start = (word << 6) - group * BITMAP_GROUP_BITS;
+    
+    if ((limit = start + 64) > reiserfs_bitmap_group_len(bitmap, group))
+	limit = reiserfs_bitmap_group_len(bitmap, group);
+	
+    return reiserfs_bitmap_group_next(bitmap, group, start, limit, 0) >= limit;
+}
+
+static void reiserfs_bitmap_dirty_range(reiserfs_bitmap_t *bitmap, 
+    blk_t start, blk_t end)
+{
+    reiserfs_tools_set_bits(bitmap->dirty, start / BITMAP_GROUP_BITS, 
+	(end - 1) / BITMAP_GROUP_BITS + 1);
+}
+
+/* Updates upper summary level after group free counter was changed */
+static void reiserfs_bitmap_group_update(reiserfs_bitmap_t *bitmap, blk_t group) {
+    if (bitmap->group_free[group])
+	reiserfs_tools_set_bit(group, bitmap->free_groups);
+    else
+	reiserfs_tools_clear_bit(group, bitmap->free_groups);
+    
+    reiserfs_tools_set_bit(group, bitmap->stale);
+}
+
+/* Recounts free head, tail and the longest free run of given group */
+static void reiserfs_bitmap_group_span(reiserfs_bitmap_t *bitmap, blk_t group) {
+    blk_t blk, end, len;
+    struct reiserfs_bitmap_span *span = &bitmap->spans[group];
+
+    len = reiserfs_bitmap_group_len(bitmap, group);
+    memset(span, 0, sizeof(*span));
+
+    for (blk = reiserfs_bitmap_group_next(bitmap, group, 0, len, 0); blk < len; 
+	blk = reiserfs_bitmap_group_next(bitmap, group, end, len, 0)) 
+    {
+	end = reiserfs_bitmap_group_next(bitmap, group, blk, len, 1);
+	
+	if (blk == 0)
+	    span->head = end;
+	
+	if (end == len)
+	    span->tail = end - blk;
+	
+	if (end - blk > span->longest) {
+	    span->longest = end - blk;
+	    span->offset = blk;
+	}
+    }
+    
+    reiserfs_tools_clear_bit(group, bitmap->stale);
+}
+
+static void reiserfs_bitmap_group_build(reiserfs_bitmap_t *bitmap, blk_t group) {
+    blk_t blk, start, len;
+
+    start = group * BITMAP_GROUP_BITS;
+    len = reiserfs_bitmap_group_len(bitmap, group);
+
+    if (!reiserfs_bitmap_chunk(bitmap, group)) {
+	if (bitmap->group_free[group])
+	    reiserfs_tools_set_bits(bitmap->nonfull, start >> 6, (start + len + 63) >> 6);
+	else
+	    reiserfs_tools_clear_bits(bitmap->nonfull, start >> 6, (start + len + 63) >> 6);
+	
+	reiserfs_bitmap_group_update(bitmap, group);
+	return;
+    }
+    
+    bitmap->group_free[group] = len - reiserfs_bitmap_group_count(bitmap, group, 0, len);
+    reiserfs_tools_clear_bits(bitmap->nonfull, start >> 6, (start + len + 63) >> 6);
+    
+    /* Visiting only words which have free blocks */
+    blk = reiserfs_bitmap_group_next(bitmap, group, 0, len, 0);
+    
+    while (blk < len) {
+	reiserfs_tools_set_bit((start + blk) >> 6, bitmap->nonfull);
+	blk = reiserfs_bitmap_group_next(bitmap, group, ((blk >> 6) + 1) << 6, len, 0);
+    }
+
+    reiserfs_bitmap_group_update(bitmap, group);
+    reiserfs_bitmap_chunk_pack(bitmap, group);
+}
+
+static int reiserfs_bitmap_summary_alloc(reiserfs_bitmap_t *bitmap) {
+    uint32_t groups, size;
+
+    groups = (bitmap->total_blocks + BITMAP_GROUP_BITS - 1) / BITMAP_GROUP_BITS;
+    size = ((bitmap->total_blocks + 63) / 64 + 7) / 8;
+
+    if (!libreiserfs_realloc((void **)&bitmap->group_free, 
+	    groups * sizeof(uint32_t)))
+	return 0;
+
+    if (!libreiserfs_realloc((void **)&bitmap->nonfull, size))
+	return 0;
+    
+    if (!libreiserfs_realloc((void **)&bitmap->dirty, (groups + 7) / 8))
+	return 0;
+    
+    if (!libreiserfs_realloc((void **)&bitmap->free_groups, (groups + 7) / 8))
+	return 0;
+    
+    if (!libreiserfs_realloc((void **)&bitmap->spans, 
+	    groups * sizeof(struct reiserfs_bitmap_span)))
+	return 0;
+    
+    if (!libreiserfs_realloc((void **)&bitmap->stale, (groups + 7) / 8))
+	return 0;
+    
+    bitmap->groups = groups;
+    memset(bitmap->nonfull, 0, size);
+    memset(bitmap->dirty, 0xff, (groups + 7) / 8);
+    memset(bitmap->free_groups, 0, (groups + 7) / 8);
+    memset(bitmap->stale, 0xff, (groups + 7) / 8);
+
+    return 1;
+}
+
+/* The whole map is considered as changed after the summary is rebuilt */
+static int reiserfs_bitmap_summary_build(reiserfs_bitmap_t *bitmap) {
+    blk_t group;
+
+    if (!reiserfs_bitmap_summary_alloc(bitmap))
+	return 0;
+    
+    for (group = 0; group < bitmap->groups; group++)
+	reiserfs_bitmap_group_build(bitmap, group);
+
+    return 1;
+}
+
+/* Counts used blocks from start to end group by group */
+static blk_t reiserfs_bitmap_count_used(reiserfs_bitmap_t *bitmap, 
+    blk_t start, blk_t end)
+{
+    blk_t group, from, to, used = 0;
+
+    for (; start < end; start = (group + 1) * BITMAP_GROUP_BITS) {
+	group = start / BITMAP_GROUP_BITS;
+	from = start - group * BITMAP_GROUP_BITS;
+	
+	if ((to = end - group * BITMAP_GROUP_BITS) > BITMAP_GROUP_BITS)
+	    to = BITMAP_GROUP_BITS;
+	
+	used += reiserfs_bitmap_group_count(bitmap, group, from, to);
+    }
+
+    return used;
+}
+
+/* Finds the first used block from start to limit, limit if there is no one */
+static blk_t reiserfs_bitmap_next_used(reiserfs_bitmap_t *bitmap, 
+    blk_t start, blk_t limit)
+{
+    blk_t group, from, to;
+
+    for (; start < limit; start = (group + 1) * BITMAP_GROUP_BITS) {
+	group = start / BITMAP_GROUP_BITS;
+	from = start - group * BITMAP_GROUP_BITS;
+	
+	if ((to = limit - group * BITMAP_GROUP_BITS) > BITMAP_GROUP_BITS)
+	    to = BITMAP_GROUP_BITS;
+	
+	if ((from = reiserfs_bitmap_group_next(bitmap, group, from, to, 1)) < to)
+	    return group * BITMAP_GROUP_BITS + from;
+    }
+
+    return limit;
+}
+
+/* Copies map bytes starting from given block into buff */
+static void reiserfs_bitmap_export(reiserfs_bitmap_t *bitmap, 
+    blk_t start, char *buff, uint32_t size)
+{
+    char *chunk;
+    blk_t group;
+    uint32_t off, len;
+
+    while (size > 0) {
+	group = start / BITMAP_GROUP_BITS;
+	off = (start - group * BITMAP_GROUP_BITS) / 8;
+	
+	if ((len = BITMAP_GROUP_BITS / 8 - off) > size)
+	    len = size;
+
+	if (!(chunk = reiserfs_bitmap_chunk(bitmap, group)))
+	    memset(buff, bitmap->group_free[group] ? 0 : 0xff, len);
+	else if (!reiserfs_bitmap_packed(bitmap, group))
+	    memcpy(buff, chunk + off, len);
+	else {
+	    struct reiserfs_bitmap_runs *runs = (struct reiserfs_bitmap_runs *)chunk;
+	    uint32_t i = reiserfs_bitmap_runs_find(runs, off * 8);
+	    blk_t from = off * 8, to = (off + len) * 8, start, end;
+	    
+	    memset(buff, 0, len);
+	    
+	    for (; i < runs->count && runs->run[i].start < to; i++) {
+		start = (runs->run[i].start > from ? runs->run[i].start : from);
+		end = ((blk_t)runs->run[i].last + 1 < to ? (blk_t)runs->run[i].last + 1 : to);
+		
+		reiserfs_tools_set_bits(buff, start - from, end - from);
+	    }
+	}
+
+	start += len * 8;
+	buff += len;
+	size -= len;
+    }
+}
+
+/* Turns compressed bitmap into plain one, whole map users need it */
+static int reiserfs_bitmap_flatten(reiserfs_bitmap_t *bitmap) {
+    blk_t group;
+    
+    if (!bitmap->chunks)
+	return 1;
+
+    if (!(bitmap->map = libreiserfs_calloc(bitmap->size, 0)))
+	return 0;
+
+    reiserfs_bitmap_export(bitmap, 0, bitmap->map, bitmap->size);
+    reiserfs_tools_clear_bits(bitmap->map, bitmap->total_blocks, bitmap->size * 8);
+
+    for (group = 0; group < bitmap->groups; group++) {
+	if (bitmap->chunks[group])
+	    libreiserfs_free(bitmap->chunks[group]);
+    }
+    
+    libreiserfs_free(bitmap->chunks);
+    bitmap->chunks = NULL;
+    
+    libreiserfs_free(bitmap->packed);
+    bitmap->packed = NULL;
+    
+    return 1;
+}
+
+/* Back to compressed form, if bitmap was opened so. Summary must be built */
+static int reiserfs_bitmap_compress(reiserfs_bitmap_t *bitmap) {
+    blk_t group;
+    char **chunks;
+    uint32_t off;
+
+    if (!(bitmap->flags & BITMAP_COMPRESSED) || bitmap->chunks)
+	return 1;
+
+    if (!(chunks = libreiserfs_calloc(bitmap->groups * sizeof(char *), 0)))
+	return 0;
+
+    if (!(bitmap->packed = libreiserfs_calloc((bitmap->groups + 7) / 8, 0)))
+	goto error_free_chunks;
+    
+    for (group = 0; group < bitmap->groups; group++) {
+	if (!bitmap->group_free[group] || bitmap->group_free[group] == 
+		reiserfs_bitmap_group_len(bitmap, group))
+	    continue;
+	
+	if (!(chunks[group] = libreiserfs_calloc(BITMAP_GROUP_BITS / 8, 0)))
+	    goto error_free_chunks;
+	
+	off = group * (BITMAP_GROUP_BITS / 8);
+	
+	memcpy(chunks[group], bitmap->map + off, (bitmap->size - off < 
+	    BITMAP_GROUP_BITS / 8 ? bitmap->size - off : BITMAP_GROUP_BITS / 8));
+    }
+
+    libreiserfs_free(bitmap->map);
+    bitmap->map = NULL;
+    bitmap->chunks = chunks;
+    
+    for (group = 0; group < bitmap->groups; group++)
+	reiserfs_bitmap_chunk_pack(bitmap, group);
+    
+    return 1;
+    
+error_free_chunks:
+    for (group = 0; group < bitmap->groups; group++) {
+	if (chunks[group])
+	    libreiserfs_free(chunks[group]);
+    }
+    libreiserfs_free(chunks);
+    
+    if (bitmap->packed) {
+	libreiserfs_free(bitmap->packed);
+	bitmap->packed = NULL;
+    }
+    return 0;
+}
+
+/* 
+    Lazily opened bitmap has only those groups in memory which were touched. 
+    Group is fetched from the bitmap blocks it lies in and gets its summary.
+*/
+static int reiserfs_bitmap_group_fetch(reiserfs_bitmap_t *bitmap, blk_t group) {
+    char *chunk;
+    blk_t start, end, bits, i;
+    reiserfs_block_t *block;
+    dal_t *dal = bitmap->fs->dal;
+
+    bits = dal_get_blocksize(dal) * 8;
+    start = group * BITMAP_GROUP_BITS;
+    end = start + reiserfs_bitmap_group_len(bitmap, group);
+
+    if (!(chunk = reiserfs_bitmap_chunk_get(bitmap, group)))
+	return 0;
+    
+    for (i = start / bits; i <= (end - 1) / bits; i++) {
+	blk_t blk = (i == 0 ? bitmap->start : i * bits);
+	blk_t from = (i * bits > start ? i * bits : start) / 8;
+	blk_t to = (((i + 1) * bits < end ? (i + 1) * bits : end) + 7) / 8;
+	
+	if (!(block = reiserfs_block_read(dal, blk))) {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		"Can't read bitmap block %lu. %s.", blk, dal_error(dal));
+	    return 0;
+	}
+
+	memcpy(chunk + (from - start / 8), block->data + (from - i * bits / 8), 
+	    to - from);
+	
+	reiserfs_block_free(block);
+    }
+    
+    /* Bits after the last block are not part of the map */
+    reiserfs_tools_clear_bits(chunk, end - start, ((end - start + 7) / 8) * 8);
+
+    reiserfs_bitmap_group_build(bitmap, group);
+    reiserfs_tools_set_bit(group, bitmap->loaded);
+    
+    return 1;
+}
+
+/* 
+    Makes sure the groups blocks from start to end lie in are in memory. 
+    Groups that couldn't be read are left out, that is reported by zero.
+*/
+static int reiserfs_bitmap_fault(reiserfs_bitmap_t *bitmap, blk_t start, blk_t end) {
+    blk_t group, last;
+    int res = 1;
+
+    if (!bitmap->loaded || start >= end)
+	return 1;
+
+    last = (end - 1) / BITMAP_GROUP_BITS;
+    
+    for (group = start / BITMAP_GROUP_BITS; group <= last; group++) {
+	group = reiserfs_tools_find_next_zero(bitmap->loaded, last + 1, group);
+	
+	if (group <= last && !reiserfs_bitmap_group_fetch(bitmap, group))
+	    res = 0;
+    }
+
+    return res;
+}
 
 void reiserfs_bitmap_use_block(reiserfs_bitmap_t *bitmap, blk_t blk) {
+    char *chunk;
+    blk_t group;
+    
     ASSERT(bitmap != NULL, return);
 
     reiserfs_bitmap_range_check(bitmap, blk, return);
-    if (reiserfs_tools_test_bit(blk, bitmap->map))
+    
+    if (!reiserfs_bitmap_fault(bitmap, blk, blk + 1))
+	return;
+    
+    group = blk / BITMAP_GROUP_BITS;
+    
+    if (!(chunk = reiserfs_bitmap_chunk_get(bitmap, group)))
+	return;
+    
+    if (reiserfs_tools_test_bit(blk - group * BITMAP_GROUP_BITS, chunk))
 	return;
 	
-    reiserfs_tools_set_bit(blk, bitmap->map);
+    reiserfs_tools_set_bit(blk - group * BITMAP_GROUP_BITS, chunk);
     bitmap->used_blocks++;
+    
+    bitmap->group_free[group]--;
+    reiserfs_tools_set_bit(group, bitmap->dirty);
+    reiserfs_bitmap_group_update(bitmap, group);
+    
+    if (reiserfs_bitmap_word_full(bitmap, blk >> 6))
+	reiserfs_tools_clear_bit(blk >> 6, bitmap->nonfull);
+
+    reiserfs_bitmap_chunk_put(bitmap, group);
 }
 
 void reiserfs_bitmap_unuse_block(reiserfs_bitmap_t *bitmap, blk_t blk) {
+    char *chunk;
+    blk_t group;
+    
     ASSERT(bitmap != NULL, return);
 
     reiserfs_bitmap_range_check(bitmap, blk, return);
-    if (!reiserfs_tools_test_bit(blk, bitmap->map))
+    
+    if (!reiserfs_bitmap_fault(bitmap, blk, blk + 1))
+	return;
+    
+    group = blk / BITMAP_GROUP_BITS;
+    
+    if (!(chunk = reiserfs_bitmap_chunk_get(bitmap, group)))
+	return;
+    
+    if (!reiserfs_tools_test_bit(blk - group * BITMAP_GROUP_BITS, chunk))
 	return;
 	
-    reiserfs_tools_clear_bit(blk, bitmap->map);
+    reiserfs_tools_clear_bit(blk - group * BITMAP_GROUP_BITS, chunk);
     bitmap->used_blocks--;
+    
+    bitmap->group_free[group]++;
+    reiserfs_tools_set_bit(group, bitmap->dirty);
+    reiserfs_bitmap_group_update(bitmap, group);
+    reiserfs_tools_set_bit(blk >> 6, bitmap->nonfull);
+    
+    reiserfs_bitmap_chunk_put(bitmap, group);
+}
+
+static void reiserfs_bitmap_word_update(reiserfs_bitmap_t *bitmap, blk_t word) {
+    if (reiserfs_bitmap_word_full(bitmap, word))
+	reiserfs_tools_clear_bit(word, bitmap->nonfull);
+    else
+	reiserfs_tools_set_bit(word, bitmap->nonfull);
+}
+
+static int reiserfs_bitmap_mark_range(reiserfs_bitmap_t *bitmap, 
+    blk_t start, blk_t end, int use) 
+{
+    int res = 1;
+    char *chunk;
+    blk_t group, from, to, used;
+
+    for (group = start / BITMAP_GROUP_BITS; group * BITMAP_GROUP_BITS < end; group++) {
+	from = (start > group * BITMAP_GROUP_BITS ? start - group * BITMAP_GROUP_BITS : 0);
+	
+	if ((to = end - group * BITMAP_GROUP_BITS) > 
+		reiserfs_bitmap_group_len(bitmap, group))
+	    to = reiserfs_bitmap_group_len(bitmap, group);
+
+	/* Compressed group which is covered entirely just becomes uniform */
+	if (bitmap->chunks && from == 0 && 
+		to == reiserfs_bitmap_group_len(bitmap, group))
+	{
+	    used = reiserfs_bitmap_count_used(bitmap, group * BITMAP_GROUP_BITS, 
+		group * BITMAP_GROUP_BITS + to);
+	    
+	    if (bitmap->chunks[group]) {
+		libreiserfs_free(bitmap->chunks[group]);
+		bitmap->chunks[group] = NULL;
+		reiserfs_tools_clear_bit(group, bitmap->packed);
+	    }
+	} else {
+	    /* Range is cut on the group which chunk couldn't be allocated for */
+	    if (!(chunk = reiserfs_bitmap_chunk_get(bitmap, group))) {
+		end = group * BITMAP_GROUP_BITS;
+		res = 0;
+		break;
+	    }
+
+	    used = reiserfs_tools_count_bits(chunk, from, to);
+	    
+	    if (use)
+		reiserfs_tools_set_bits(chunk, from, to);
+	    else
+		reiserfs_tools_clear_bits(chunk, from, to);
+	}
+	
+	if (use) {
+	    bitmap->group_free[group] -= (to - from) - used;
+	    bitmap->used_blocks += (to - from) - used;
+	} else {
+	    bitmap->group_free[group] += used;
+	    bitmap->used_blocks -= used;
+	}
+
+	reiserfs_bitmap_group_update(bitmap, group);
+	reiserfs_bitmap_chunk_put(bitmap, group);
+    }
+
+    if (start >= end)
+	return res;
+    
+    reiserfs_bitmap_dirty_range(bitmap, start, end);
+    
+    if (use) {
+	/* Words inside the range are full now, edge ones may be not */
+	reiserfs_tools_clear_bits(bitmap->nonfull, (start + 63) >> 6, end >> 6);
+	reiserfs_bitmap_word_update(bitmap, start >> 6);
+	reiserfs_bitmap_word_update(bitmap, (end - 1) >> 6);
+    } else
+	reiserfs_tools_set_bits(bitmap->nonfull, start >> 6, ((end - 1) >> 6) + 1);
+
+    return res;
+}
+
+void reiserfs_bitmap_use_range(reiserfs_bitmap_t *bitmap, blk_t start, count_t count) {
+    ASSERT(bitmap != NULL, return);
+
+    if (!count) return;
+    
+    reiserfs_bitmap_range_check(bitmap, start, return);
+    reiserfs_bitmap_range_check(bitmap, start + count - 1, return);
+    
+    if (!reiserfs_bitmap_fault(bitmap, start, start + count))
+	return;
+    
+    reiserfs_bitmap_mark_range(bitmap, start, start + count, 1);
+}
+
+void reiserfs_bitmap_unuse_range(reiserfs_bitmap_t *bitmap, blk_t start, count_t count) {
+    ASSERT(bitmap != NULL, return);
+
+    if (!count) return;
+    
+    reiserfs_bitmap_range_check(bitmap, start, return);
+    reiserfs_bitmap_range_check(bitmap, start + count - 1, return);
+    
+    if (!reiserfs_bitmap_fault(bitmap, start, start + count))
+	return;
+    
+    reiserfs_bitmap_mark_range(bitmap, start, start + count, 0);
 }
 
 int reiserfs_bitmap_test_block(reiserfs_bitmap_t *bitmap, blk_t blk) {
+    blk_t group;
+    
     ASSERT(bitmap != NULL, return 0);
 
     reiserfs_bitmap_range_check(bitmap, blk, return 0);
-    return reiserfs_tools_test_bit(blk, bitmap->map);
+
+    /* Block which state is unknown is considered as used */
+    if (!reiserfs_bitmap_fault(bitmap, blk, blk + 1))
+	return 1;
+    
+    group = blk / BITMAP_GROUP_BITS;
+    return reiserfs_bitmap_group_test(bitmap, group, blk - group * BITMAP_GROUP_BITS);
 }
 
 blk_t reiserfs_bitmap_find_free(reiserfs_bitmap_t *bitmap, blk_t start) {
-    blk_t blk;
+    blk_t blk, limit, next, base;
 	
     ASSERT(bitmap != NULL, return 0);
 	
     reiserfs_bitmap_range_check(bitmap, start, return 0);
-    if ((blk = reiserfs_tools_find_next_zero_bit(bitmap->map, 
-	    bitmap->total_blocks, start)) >= bitmap->total_blocks)
-	return 0;
 
-    return blk;
+    /* Looking at the rest of the word start lies in */
+    if ((limit = ((start >> 6) + 1) << 6) > bitmap->total_blocks)
+	limit = bitmap->total_blocks;
+
+    if (reiserfs_bitmap_fault(bitmap, start, limit)) {
+	base = (start / BITMAP_GROUP_BITS) * BITMAP_GROUP_BITS;
+	
+	if ((blk = reiserfs_bitmap_group_next(bitmap, start / BITMAP_GROUP_BITS, 
+		start - base, limit - base, 0)) < limit - base)
+	    return base + blk;
+    }
+
+    /* Then jumping over full groups and full words of the others */
+    for (next = limit; next < bitmap->total_blocks; ) {
+	blk_t group, word, words;
+
+	/* Groups not fetched yet look free, so only they are faulted in */
+	if ((group = reiserfs_tools_find_next_set(bitmap->free_groups, 
+		bitmap->groups, next / BITMAP_GROUP_BITS)) >= bitmap->groups)
+	    break;
+
+	if (group * BITMAP_GROUP_BITS > next)
+	    next = group * BITMAP_GROUP_BITS;
+	
+	if (reiserfs_bitmap_fault(bitmap, next, next + 1) && 
+		bitmap->group_free[group]) 
+	{
+	    if ((words = ((group + 1) * BITMAP_GROUP_BITS) >> 6) > 
+		    (bitmap->total_blocks + 63) >> 6)
+		words = (bitmap->total_blocks + 63) >> 6;
+	    
+	    if ((word = reiserfs_tools_find_next_set(bitmap->nonfull, words, 
+		    next >> 6)) < words)
+	    {
+		base = group * BITMAP_GROUP_BITS;
+		
+		return base + reiserfs_bitmap_group_next(bitmap, group, (word << 6) - base, 
+		    reiserfs_bitmap_group_len(bitmap, group), 0);
+	    }
+	}
+	
+	next = (group + 1) * BITMAP_GROUP_BITS;
+    }
+
+    return 0;
+}
+
+/* 
+    Finds the first free extent at or after goal which is at least min_len 
+    blocks long. Found extent is cut to max_len blocks and its length is put 
+    into len. Zero is returned if there is no such extent.
+*/
+blk_t reiserfs_bitmap_find_free_extent(reiserfs_bitmap_t *bitmap, blk_t goal, 
+    count_t min_len, count_t max_len, count_t *len) 
+{
+    blk_t blk, end, limit;
+	
+    ASSERT(bitmap != NULL, return 0);
+    ASSERT(min_len > 0 && min_len <= max_len, return 0);
+	
+    if (len) *len = 0;
+	
+    reiserfs_bitmap_range_check(bitmap, goal, return 0);
+
+    for (blk = goal; blk < bitmap->total_blocks; blk = end) {
+	if (reiserfs_bitmap_test_block(bitmap, blk) && 
+		!(blk = reiserfs_bitmap_find_free(bitmap, blk)))
+	    break;
+
+	if ((limit = blk + max_len) > bitmap->total_blocks || limit < blk)
+	    limit = bitmap->total_blocks;
+	
+	/* Extent is cut on the first group which couldn't be fetched */
+	while (!reiserfs_bitmap_fault(bitmap, blk, limit))
+	    limit = reiserfs_tools_find_next_zero(bitmap->loaded, 
+		(limit - 1) / BITMAP_GROUP_BITS + 1, blk / BITMAP_GROUP_BITS) * 
+		BITMAP_GROUP_BITS;
+	
+	end = reiserfs_bitmap_next_used(bitmap, blk, limit);
+	
+	if (end - blk >= min_len) {
+	    if (len) *len = end - blk;
+	    return blk;
+	}
+    }
+    
+    return 0;
+}
+
+/* 
+    Only stale groups are rescanned, the rest is told by the group spans. Run 
+    which crosses group bounds is joined from the tail of one group, the free 
+    groups after it and the head of the next one.
+*/
+count_t reiserfs_bitmap_largest_free(reiserfs_bitmap_t *bitmap, blk_t *start) {
+    blk_t group, base, len, run_start = 0;
+    count_t largest = 0, run = 0;
+    struct reiserfs_bitmap_span *span;
+	
+    ASSERT(bitmap != NULL, return 0);
+
+    /* Lazy bitmap has nothing known about not fetched groups */
+    if (!reiserfs_bitmap_fault(bitmap, 0, bitmap->total_blocks))
+	return 0;
+    
+    for (group = reiserfs_tools_find_next_set(bitmap->stale, bitmap->groups, 0); 
+	group < bitmap->groups; group = reiserfs_tools_find_next_set(bitmap->stale, 
+	bitmap->groups, group + 1))
+	reiserfs_bitmap_group_span(bitmap, group);
+    
+    for (group = 0; group < bitmap->groups; group++) {
+	span = &bitmap->spans[group];
+	base = group * BITMAP_GROUP_BITS;
+	len = reiserfs_bitmap_group_len(bitmap, group);
+	
+	if (!run)
+	    run_start = base;
+	
+	if (span->head == len) {
+	    run += len;
+	    continue;
+	}
+	
+	if (run + span->head > largest) {
+	    largest = run + span->head;
+	    if (start) *start = run_start;
+	}
+	
+	if (span->longest > largest) {
+	    largest = span->longest;
+	    if (start) *start = base + span->offset;
+	}
+	
+	run = span->tail;
+	run_start = base + len - span->tail;
+    }
+    
+    if (run > largest) {
+	largest = run;
+	if (start) *start = run_start;
+    }
+    
+    return largest;
 }
 
 static blk_t reiserfs_bitmap_calc(reiserfs_bitmap_t *bitmap, 
     blk_t start, blk_t end, int is_free) 
 {
-    blk_t i, blocks = 0;
+    blk_t used;
 	
     ASSERT(bitmap != NULL, return 0);
 	
     reiserfs_bitmap_range_check(bitmap, start, return 0);
     reiserfs_bitmap_range_check(bitmap, end - 1, return 0);
 	
-    for (i = start; i < end; ) {
-#if !defined(__sparc__) && !defined(__sparcv9)
-	uint64_t *block64 = (uint64_t *)(bitmap->map + (i >> 0x3));
-	uint16_t bits = sizeof(uint64_t) * 8;
-		
-	if (i + bits < end && i % 0x8 == 0 &&
-	    *block64 == (is_free == 0 ? 0xffffffffffffffffLL : 0)) 
-	{
-	    blocks += bits;
-	    i += bits;
-	} else {
-	    blocks += (reiserfs_bitmap_test_block(bitmap, i) ? is_free : !is_free);
-	    i++;
-	}
-#else
-	blocks += (reiserfs_bitmap_test_block(bitmap, i) ? is_free : !is_free);
-	i++;	
-#endif
-    }
-    return blocks;
+    if (!reiserfs_bitmap_fault(bitmap, start, end))
+	return 0;
+    
+    used = reiserfs_bitmap_count_used(bitmap, start, end);
+    return (is_free ? (end - start) - used : used);
 }
 
 blk_t reiserfs_bitmap_calc_used(reiserfs_bitmap_t *bitmap) {
@@ -139,7 +1004,8 @@ int reiserfs_bitmap_check(reiserfs_bitmap_t *bitmap) {
     return 1;
 }
 
-reiserfs_bitmap_t *reiserfs_bitmap_alloc(blk_t len) {
+static reiserfs_bitmap_t *reiserfs_bitmap_alloc_as(blk_t len, int flags) {
+    blk_t group;
     reiserfs_bitmap_t *bitmap;
 	
     ASSERT(len > 0, goto error);
@@ -150,9 +1016,32 @@ reiserfs_bitmap_t *reiserfs_bitmap_alloc(blk_t len) {
     bitmap->used_blocks = 0;
     bitmap->total_blocks = len;
     bitmap->size = (len + 7) / 8;
+    bitmap->flags = flags;
+    
+    if (!(flags & BITMAP_COMPRESSED)) {
+	if (!(bitmap->map = (char *)libreiserfs_calloc(bitmap->size, 0)))
+	    goto error_free_bitmap;
+	
+	if (!reiserfs_bitmap_summary_build(bitmap))
+	    goto error_free_bitmap;
+
+	return bitmap;
+    }
+
+    /* Compressed bitmap starts with all groups uniform and free */
+    if (!reiserfs_bitmap_summary_alloc(bitmap))
+	goto error_free_bitmap;
     
-    if (!(bitmap->map = (char *)libreiserfs_calloc(bitmap->size, 0)))
+    if (!(bitmap->chunks = libreiserfs_calloc(bitmap->groups * sizeof(char *), 0)))
+	goto error_free_bitmap;
+
+    if (!(bitmap->packed = libreiserfs_calloc((bitmap->groups + 7) / 8, 0)))
 	goto error_free_bitmap;
+
+    for (group = 0; group < bitmap->groups; group++) {
+	bitmap->group_free[group] = reiserfs_bitmap_group_len(bitmap, group);
+	reiserfs_bitmap_group_build(bitmap, group);
+    }
 	
     return bitmap;
 	
@@ -162,19 +1051,39 @@ error:
     return NULL;
 }
 
+reiserfs_bitmap_t *reiserfs_bitmap_alloc(blk_t len) {
+    return reiserfs_bitmap_alloc_as(len, 0);
+}
+
 static int callback_bitmap_flush(dal_t *dal, 
     blk_t blk, char *map, uint32_t chunk, void *data) 
 {
+    blk_t start;
     reiserfs_block_t *block;
     reiserfs_bitmap_t *bitmap = (reiserfs_bitmap_t *)data;
+
+    (void)map;
+    
+    /* Bitmap blocks which weren't changed are not written */
+    start = (blk == bitmap->start ? 0 : blk);
+    
+    if (reiserfs_tools_find_next_set(bitmap->dirty, (start + chunk * 8 - 1) / 
+	    BITMAP_GROUP_BITS + 1, start / BITMAP_GROUP_BITS) > 
+	    (start + chunk * 8 - 1) / BITMAP_GROUP_BITS)
+	return 1;
+
+    /* Dirty block may have not yet fetched groups when it covers several */
+    if (!reiserfs_bitmap_fault(bitmap, start, (start + chunk * 8 > 
+	    bitmap->total_blocks ? bitmap->total_blocks : start + chunk * 8)))
+	return 0;
 	
     if (!(block = reiserfs_block_alloc(dal, blk, 0xff)))
 	goto error;
 
-    memcpy(block->data, map, chunk);
+    reiserfs_bitmap_export(bitmap, start, block->data, chunk);
 
     /* Marking the rest of last byte of the bitmap as used */
-    if ((map + chunk) - bitmap->map >= (long)bitmap->size) {
+    if (start / 8 + chunk >= bitmap->size) {
 	uint32_t i, unused_bits = bitmap->size * 8 - bitmap->total_blocks;
 	for (i = 0; i < unused_bits; i++) {
 	    reiserfs_tools_set_bit((bitmap->total_blocks % 
@@ -239,26 +1148,65 @@ int reiserfs_bitmap_pipe(reiserfs_bitmap_t *bitmap,
 	blk = (blk / (dal_get_blocksize(bitmap->fs->dal) * 8) + 1) * 
 	    (dal_get_blocksize(bitmap->fs->dal) * 8);
 
-	map += chunk;
+	if (map) 
+	    map += chunk;
+	
 	left -= chunk;
     }
 	
     return 1;
 }
 
-reiserfs_bitmap_t *reiserfs_bitmap_open(reiserfs_fs_t *fs, 
-    blk_t start, count_t len) 
+/* 
+    Opens bitmap. With BITMAP_LAZY nothing is read here, groups are fetched 
+    on first access and used blocks count is taken from the superblock. It 
+    may be verified later by reiserfs_bitmap_check. BITMAP_COMPRESSED keeps 
+    memory only for groups which have both free and used blocks.
+*/
+reiserfs_bitmap_t *reiserfs_bitmap_open_as(reiserfs_fs_t *fs, 
+    blk_t start, count_t len, int flags) 
 {
     reiserfs_bitmap_t *bitmap;
     uint32_t i, unused_bits;
 
     ASSERT(fs != NULL, return NULL);
 	
-    if(!(bitmap = reiserfs_bitmap_alloc(len)))
+    if ((flags & BITMAP_LAZY) && get_sb_free_blocks(fs->super) >= len) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    "Invalid free blocks count %lu in the superblock.", 
+	    get_sb_free_blocks(fs->super));
+	goto error;
+    }
+	
+    if(!(bitmap = reiserfs_bitmap_alloc_as(len, flags)))
 	goto error;
 	
     bitmap->start = start;
     bitmap->fs = fs;
+
+    if ((flags & BITMAP_LAZY) || bitmap->chunks) {
+	if (!(bitmap->loaded = libreiserfs_calloc((bitmap->groups + 7) / 8, 0)))
+	    goto error_free_bitmap;
+	
+	memset(bitmap->dirty, 0, (bitmap->groups + 7) / 8);
+	
+	if (flags & BITMAP_LAZY) {
+	    bitmap->used_blocks = len - get_sb_free_blocks(fs->super);
+	    return bitmap;
+	}
+
+	/* Compressed bitmap is fetched group by group */
+	if (!reiserfs_bitmap_fault(bitmap, 0, len))
+	    goto error_free_bitmap;
+
+	libreiserfs_free(bitmap->loaded);
+	bitmap->loaded = NULL;
+	
+	if (!(bitmap->used_blocks = reiserfs_bitmap_calc_used(bitmap)))
+	    goto error_free_bitmap;
+	
+	return bitmap;
+    }
 	
     if (!reiserfs_bitmap_pipe(bitmap, callback_bitmap_fetch, (void *)bitmap))
 	goto error_free_bitmap;
@@ -271,6 +1219,12 @@ reiserfs_bitmap_t *reiserfs_bitmap_open(reiserfs_fs_t *fs,
     if (!(bitmap->used_blocks = reiserfs_bitmap_calc_used(bitmap)))
 	goto error_free_bitmap;
 	
+    if (!reiserfs_bitmap_summary_build(bitmap))
+	goto error_free_bitmap;
+
+    /* Just fetched map is the same as on disk */
+    memset(bitmap->dirty, 0, (bitmap->groups + 7) / 8);
+	
     return bitmap;
 	
 error_free_bitmap:
@@ -279,6 +1233,12 @@ error:
     return NULL;
 }
 
+reiserfs_bitmap_t *reiserfs_bitmap_open(reiserfs_fs_t *fs, 
+    blk_t start, count_t len) 
+{
+    return reiserfs_bitmap_open_as(fs, start, len, 0);
+}
+
 reiserfs_bitmap_t *reiserfs_bitmap_create(reiserfs_fs_t *fs, 
     blk_t start, count_t len) 
 {
@@ -369,9 +1329,25 @@ int reiserfs_bitmap_resize(reiserfs_bitmap_t *bitmap,
     ASSERT(bitmap != NULL, return 0);
     ASSERT(end - start > 0, return 0);
 
-    if ((size = reiserfs_bitmap_resize_map(bitmap, start, 
-	    end, dal_get_blocksize(bitmap->fs->dal))) - bitmap->size == 0)
-	return 1;
+    if (!reiserfs_bitmap_fault(bitmap, 0, bitmap->total_blocks))
+	return 0;
+
+    /* Whole map is in memory from now on */
+    if (bitmap->loaded) {
+	libreiserfs_free(bitmap->loaded);
+	bitmap->loaded = NULL;
+    }
+
+    if (!reiserfs_bitmap_flatten(bitmap))
+	return 0;
+    
+    if (!(size = reiserfs_bitmap_resize_map(bitmap, start, 
+	    end, dal_get_blocksize(bitmap->fs->dal))))
+	return 0;
+    
+    /* Shifted map is built anew even if its size is the same */
+    if (start == 0 && size - bitmap->size == 0)
+	return reiserfs_bitmap_compress(bitmap);
 
     bmap_old_blknr = bitmap->size / dal_get_blocksize(bitmap->fs->dal);
     
@@ -381,13 +1357,19 @@ int reiserfs_bitmap_resize(reiserfs_bitmap_t *bitmap,
     bitmap->size = size;
     bitmap->total_blocks = end - start;
 	
+    if (!reiserfs_bitmap_summary_build(bitmap))
+	return 0;
+	
+    /* Map was rebuilt, so all of it differs from what is on disk */
+    reiserfs_tools_set_bits(bitmap->dirty, 0, bitmap->groups);
+	
     /* Marking new bitmap blocks as used */
     if (bmap_new_blknr - bmap_old_blknr > 0) {
 	for (i = bmap_old_blknr; i < bmap_new_blknr; i++)
 	    reiserfs_bitmap_use_block(bitmap, i * dal_get_blocksize(bitmap->fs->dal) * 8);
     }
 
-    return 1;
+    return reiserfs_bitmap_compress(bitmap);
 }
 
 blk_t reiserfs_bitmap_copy(reiserfs_bitmap_t *dest_bitmap, 
@@ -400,13 +1382,25 @@ blk_t reiserfs_bitmap_copy(reiserfs_bitmap_t *dest_bitmap,
     if (!len) 
 	return 0;
 	
+    if (!reiserfs_bitmap_fault(src_bitmap, 0, src_bitmap->total_blocks))
+	return 0;
+    
     if (!reiserfs_bitmap_resize(dest_bitmap, 0, (len > src_bitmap->total_blocks ? 
 	    src_bitmap->total_blocks : len)))
         return 0;
 	
+    if (!reiserfs_bitmap_flatten(dest_bitmap) || !reiserfs_bitmap_flatten(src_bitmap))
+	return 0;
+    
     memcpy(dest_bitmap->map, src_bitmap->map, dest_bitmap->size);
     dest_bitmap->used_blocks = reiserfs_bitmap_used(dest_bitmap);
 
+    if (!reiserfs_bitmap_summary_build(dest_bitmap))
+	return 0;
+
+    if (!reiserfs_bitmap_compress(dest_bitmap) || !reiserfs_bitmap_compress(src_bitmap))
+	return 0;
+    
     return dest_bitmap->total_blocks;
 }
 
@@ -415,20 +1409,39 @@ reiserfs_bitmap_t *reiserfs_bitmap_clone(reiserfs_bitmap_t *bitmap) {
 
     ASSERT(bitmap != NULL, return 0);	
 
+    if (!reiserfs_bitmap_fault(bitmap, 0, bitmap->total_blocks))
+	return NULL;
+    
     if (!(clone = reiserfs_bitmap_alloc(bitmap->total_blocks)))
 	return NULL;
 	
-    memcpy(clone->map, bitmap->map, clone->size);
-    clone->used_blocks = reiserfs_bitmap_used(clone);
+    reiserfs_bitmap_export(bitmap, 0, clone->map, clone->size);
+    reiserfs_tools_clear_bits(clone->map, clone->total_blocks, clone->size * 8);
+    
+    clone->used_blocks = reiserfs_bitmap_used(bitmap);
+    clone->flags = bitmap->flags & BITMAP_COMPRESSED;
+	
+    if (!reiserfs_bitmap_summary_build(clone) || !reiserfs_bitmap_compress(clone)) {
+	reiserfs_bitmap_close(clone);
+	return NULL;
+    }
 	
     return clone;
 }
 
 int reiserfs_bitmap_sync(reiserfs_bitmap_t *bitmap) {
+    blk_t group;
 
     if (!reiserfs_bitmap_pipe(bitmap, callback_bitmap_flush, (void *)bitmap))
 	return 0;
 
+    /* Changed groups of compressed bitmap are kept plain until they are synced */
+    for (group = 0; group < bitmap->groups; group++) {
+	if (reiserfs_tools_test_bit(group, bitmap->dirty))
+	    reiserfs_bitmap_chunk_pack(bitmap, group);
+    }
+
+    memset(bitmap->dirty, 0, (bitmap->groups + 7) / 8);
     return 1;
 }
 
@@ -438,12 +1451,47 @@ void reiserfs_bitmap_close(reiserfs_bitmap_t *bitmap) {
     if (bitmap->map)
 	libreiserfs_free(bitmap->map);
 
+    if (bitmap->group_free)
+	libreiserfs_free(bitmap->group_free);
+    
+    if (bitmap->nonfull)
+	libreiserfs_free(bitmap->nonfull);
+
+    if (bitmap->free_groups)
+	libreiserfs_free(bitmap->free_groups);
+    
+    if (bitmap->spans)
+	libreiserfs_free(bitmap->spans);
+    
+    if (bitmap->stale)
+	libreiserfs_free(bitmap->stale);
+    
+    if (bitmap->dirty)
+	libreiserfs_free(bitmap->dirty);
+
+    if (bitmap->loaded)
+	libreiserfs_free(bitmap->loaded);
+
+    if (bitmap->chunks) {
+	blk_t group;
+	
+	for (group = 0; group < bitmap->groups; group++) {
+	    if (bitmap->chunks[group])
+		libreiserfs_free(bitmap->chunks[group]);
+	}
+	libreiserfs_free(bitmap->chunks);
+    }
+    
+    if (bitmap->packed)
+	libreiserfs_free(bitmap->packed);
+    
     libreiserfs_free(bitmap);
 }
 
 reiserfs_bitmap_t *reiserfs_bitmap_reopen(reiserfs_bitmap_t *bitmap) {
     blk_t start;
     count_t len;
+    int flags;
     reiserfs_fs_t *fs;
 	
     ASSERT(bitmap != NULL, return NULL);
@@ -451,14 +1499,23 @@ reiserfs_bitmap_t *reiserfs_bitmap_reopen(reiserfs_bitmap_t *bitmap) {
     fs = bitmap->fs;
     start = bitmap->start;
     len = bitmap->total_blocks;
+    flags = bitmap->flags;
 	    
     reiserfs_bitmap_close(bitmap);
 
-    return reiserfs_bitmap_open(fs, start, len);
+    return reiserfs_bitmap_open_as(fs, start, len, flags);
 }
 
+/* Compressed bitmap becomes plain one to give the map */
 char *reiserfs_bitmap_map(reiserfs_bitmap_t *bitmap) {
     ASSERT(bitmap != NULL, return NULL);
+
+    if (!reiserfs_bitmap_fault(bitmap, 0, bitmap->total_blocks))
+	return NULL;
+    
+    if (!reiserfs_bitmap_flatten(bitmap))
+	return NULL;
+    
     return bitmap->map;
 }
 
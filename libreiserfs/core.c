@@ -393,11 +393,8 @@ int reiserfs_fs_journal_create(reiserfs_fs_t *fs, dal_t *dal, blk_t start,
 	
     /* Marking journal blocks as used. */
     if (!relocated) {
-	blk_t blk;
-		
 	/* Marking len and journal parameters block. */
-	for (blk = start; blk < start + len + 1; blk++)
-	    reiserfs_fs_bitmap_use_block(fs, blk);
+	reiserfs_fs_bitmap_use_range(fs, start, len + 1);
     }
 	
     reiserfs_fs_mark_journal_clean(fs);
@@ -478,6 +475,24 @@ void reiserfs_fs_bitmap_unuse_block(reiserfs_fs_t *fs, blk_t block) {
     reiserfs_fs_mark_bitmap_dirty(fs);
 }
 
+void reiserfs_fs_bitmap_use_range(reiserfs_fs_t *fs, blk_t start, count_t count) {
+    ASSERT(fs != NULL, return);
+
+    reiserfs_fs_bitmap_check_state(fs, return);
+	
+    reiserfs_bitmap_use_range(fs->bitmap, start, count);
+    reiserfs_fs_mark_bitmap_dirty(fs);
+}
+
+void reiserfs_fs_bitmap_unuse_range(reiserfs_fs_t *fs, blk_t start, count_t count) {
+    ASSERT(fs != NULL, return);
+
+    reiserfs_fs_bitmap_check_state(fs, return);
+	
+    reiserfs_bitmap_unuse_range(fs->bitmap, start, count);
+    reiserfs_fs_mark_bitmap_dirty(fs);
+}
+
 int reiserfs_fs_bitmap_test_block(reiserfs_fs_t *fs, blk_t block) {
 	
     ASSERT(fs != NULL, return 0);
@@ -495,6 +510,15 @@ blk_t reiserfs_fs_bitmap_find_free_block(reiserfs_fs_t *fs,
     return reiserfs_bitmap_find_free(fs->bitmap, start);
 }
 
+blk_t reiserfs_fs_bitmap_find_free_extent(reiserfs_fs_t *fs, blk_t goal, 
+    count_t min_len, count_t max_len, count_t *len)
+{
+    ASSERT(fs != NULL, return 0);
+	
+    reiserfs_fs_bitmap_check_state(fs, return 0);
+    return reiserfs_bitmap_find_free_extent(fs->bitmap, goal, min_len, max_len, len);
+}
+
 blk_t reiserfs_fs_bitmap_calc_used(reiserfs_fs_t *fs) {
     ASSERT(fs != NULL, return 0);
 	
@@ -530,7 +554,7 @@ int reiserfs_fs_bitmap_check(reiserfs_fs_t *fs) {
     return reiserfs_bitmap_check(fs->bitmap);
 }
 
-int reiserfs_fs_bitmap_open(reiserfs_fs_t *fs) {
+static int reiserfs_fs_bitmap_open_as(reiserfs_fs_t *fs, int flags) {
 	
     ASSERT(fs != NULL, return 0);
 	
@@ -540,8 +564,8 @@ int reiserfs_fs_bitmap_open(reiserfs_fs_t *fs) {
 	return 0;
     }
 
-    if (!(fs->bitmap = reiserfs_bitmap_open(fs, fs->super_off + 1,
-					    get_sb_block_count(fs->super)))) {
+    if (!(fs->bitmap = reiserfs_bitmap_open_as(fs, fs->super_off + 1,
+					    get_sb_block_count(fs->super), flags))) {
 	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
 	    _("Couldn't open bitmap."));
 	return 0;
@@ -551,6 +575,10 @@ int reiserfs_fs_bitmap_open(reiserfs_fs_t *fs) {
     return 1;
 }
 
+int reiserfs_fs_bitmap_open(reiserfs_fs_t *fs) {
+    return reiserfs_fs_bitmap_open_as(fs, 0);
+}
+
 int reiserfs_fs_bitmap_create(reiserfs_fs_t *fs, size_t blocksize, blk_t fs_len) {
 
     ASSERT(fs != NULL, return 0);
@@ -574,12 +602,8 @@ int reiserfs_fs_bitmap_create(reiserfs_fs_t *fs, size_t blocksize, blk_t fs_len)
 }
 
 static void reiserfs_fs_bitmap_mark(reiserfs_fs_t *fs, reiserfs_segment_t *segment, int mark) {
-    blk_t i;
-	
-    for (i = 0; i < reiserfs_segment_len(segment); i++) {
-	mark ? reiserfs_fs_bitmap_use_block(fs, segment->start + i) : 
-	    reiserfs_fs_bitmap_unuse_block(fs, segment->start + i);
-    }	
+    mark ? reiserfs_fs_bitmap_use_range(fs, segment->start, reiserfs_segment_len(segment)) :
+	reiserfs_fs_bitmap_unuse_range(fs, segment->start, reiserfs_segment_len(segment));
 }
 
 int reiserfs_fs_bitmap_resize(reiserfs_fs_t *fs, long start, long end) {
@@ -623,9 +647,15 @@ void reiserfs_fs_bitmap_close(reiserfs_fs_t *fs) {
 }
 
 int reiserfs_fs_bitmap_reopen(reiserfs_fs_t *fs) {
+    int flags;
+    
     ASSERT(fs != NULL, return 0);
+    reiserfs_fs_bitmap_check_state(fs, return 0);
+    
+    flags = fs->bitmap->flags;
     reiserfs_fs_bitmap_close(fs);
-    return reiserfs_fs_bitmap_open(fs);
+    
+    return reiserfs_fs_bitmap_open_as(fs, flags);
 }    
 
 reiserfs_bitmap_t *reiserfs_fs_bitmap(reiserfs_fs_t *fs) {
@@ -831,7 +861,7 @@ int reiserfs_fs_super_create(reiserfs_fs_t *fs, int format, reiserfs_hash_t hash
     const char *label, const char *uuid, size_t blocksize, blk_t start, 
     blk_t len, blk_t fs_len, int relocated)
 {
-    blk_t sb_blk, blk;
+    blk_t sb_blk;
     reiserfs_super_t *sb;
     reiserfs_block_t *block;
 
@@ -905,8 +935,7 @@ int reiserfs_fs_super_create(reiserfs_fs_t *fs, int format, reiserfs_hash_t hash
     reiserfs_block_free(block);
 	
     /* Marking skiped blocks used and super block as used. */
-    for (blk = 0; blk <= sb_blk; blk++)
-    	reiserfs_fs_bitmap_use_block(fs, blk);
+    reiserfs_fs_bitmap_use_range(fs, 0, sb_blk + 1);
 
     reiserfs_fs_mark_super_dirty(fs);
     reiserfs_fs_mark_bitmap_dirty(fs);
@@ -928,6 +957,7 @@ int reiserfs_fs_set_root(reiserfs_fs_t *fs, blk_t blk) {
 	
     set_sb_root_block(fs->super, blk);
     reiserfs_fs_mark_super_dirty(fs);
+    reiserfs_object_scache_invalidate(fs, 0);
 	
     return 1;
 }
@@ -1285,8 +1315,87 @@ void *reiserfs_fs_tree(reiserfs_fs_t *fs) {
     return fs->tree;
 }
 
+/* 
+    Calls scan_func for every item of types from type_mask. Leaves are read in 
+    ascending block order, adjacent ones by one request, so the whole volume 
+    is scanned in a single sequential sweep. Scanning stops as soon as 
+    scan_func returns zero.
+*/
+int reiserfs_fs_scan_items(reiserfs_fs_t *fs, uint32_t type_mask, 
+    reiserfs_fs_scan_func_t scan_func, void *data)
+{
+    char *buff;
+    blk_t *leaves;
+    uint32_t i, j, pos, run, count, blocksize;
+    reiserfs_block_t *leaf;
+    reiserfs_item_head_t *item;
+	
+    ASSERT(fs != NULL, return 0);
+    ASSERT(scan_func != NULL, return 0);
+	
+    if (!reiserfs_tree_leaves(fs->tree, &leaves, &count))
+	return 0;
+	
+    if (count == 0)
+	return 1;
+	
+    blocksize = reiserfs_fs_block_size(fs);
+	
+    if (!(buff = libreiserfs_calloc(FS_SCAN_RUN_MAX * blocksize, 0)))
+	goto error_free_leaves;
+	
+    if (!(leaf = reiserfs_block_alloc(fs->dal, leaves[0], 0)))
+	goto error_free_buff;
+	
+    for (i = 0; i < count; i += run) {
+	for (run = 1; i + run < count && run < FS_SCAN_RUN_MAX && 
+		leaves[i + run] == leaves[i] + run; run++);
+	
+	if (!dal_read(fs->dal, buff, leaves[i], run)) {
+	    reiserfs_block_reading_failed(leaves[i], dal_error(fs->dal), 
+		goto error_free_leaf);
+	}
+	
+	for (j = 0; j < run; j++) {
+	    memcpy(leaf->data, buff + j * blocksize, blocksize);
+	    reiserfs_block_set_nr(leaf, leaves[i + j]);
+	    
+	    if (!is_leaf_node(leaf)) {
+		libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		    _("Invalid leaf detected (%lu)."), leaves[i + j]);
+		goto error_free_leaf;
+	    }
+	    
+	    for (pos = 0; pos < get_node_nritems(get_node_head(leaf)); pos++) {
+		item = get_ih_item_head(leaf, pos);
+		
+		if (reiserfs_key_type(&item->ih_key) > KEY_TYPE_DR || 
+			!(type_mask & (1 << reiserfs_key_type(&item->ih_key))))
+		    continue;
+		
+		if (!scan_func(leaf, item, get_ih_item_body(leaf, item), data))
+		    goto error_free_leaf;
+	    }
+	}
+    }
+	
+    reiserfs_block_free(leaf);
+    libreiserfs_free(buff);
+    libreiserfs_free(leaves);
+	
+    return 1;
+	
+error_free_leaf:
+    reiserfs_block_free(leaf);
+error_free_buff:
+    libreiserfs_free(buff);
+error_free_leaves:
+    libreiserfs_free(leaves);
+    return 0;
+}
+
 static reiserfs_fs_t *reiserfs_fs_open_as(dal_t *host_dal, dal_t *journal_dal, 
-    int with_bitmap) 
+    int with_bitmap, int bitmap_flags, int overlay) 
 {
     reiserfs_fs_t *fs;
     reiserfs_super_t *sb;
@@ -1305,7 +1414,7 @@ static reiserfs_fs_t *reiserfs_fs_open_as(dal_t *host_dal, dal_t *journal_dal,
 	dal_set_blocksize(journal_dal, get_sb_block_size(fs->super));
 	
     if (with_bitmap && !reiserfs_fs_is_consistent(fs)) {
-	if (dal_flags(host_dal) & O_RDWR) {
+	if ((dal_flags(host_dal) & O_RDWR) && !overlay) {
 	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
 		_("Filesystem isn't consistent. Couldn't open it for write."));
 	    goto error_free_fs;
@@ -1315,6 +1424,14 @@ static reiserfs_fs_t *reiserfs_fs_open_as(dal_t *host_dal, dal_t *journal_dal,
 		_("Filesystem isn't consistent."));
     }
 	
+    if (overlay && (!journal_dal || 
+	get_jp_magic(get_sb_jp(fs->super)) == JOURNAL_NEED_TUNE))
+    {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Journal overlay needs opened journal."));
+	goto error_free_super;
+    }
+	
     if (get_jp_magic(get_sb_jp(fs->super)) != JOURNAL_NEED_TUNE) {
 	if (reiserfs_fs_journal_relocated(fs) && journal_dal && 
 	    dal_equals(host_dal, journal_dal)) 
@@ -1328,7 +1445,25 @@ static reiserfs_fs_t *reiserfs_fs_open_as(dal_t *host_dal, dal_t *journal_dal,
 	    if (!reiserfs_fs_journal_open(fs, journal_dal))
 		goto error_free_super;
 		
-	    /* Reopening the superblock that can logged by the journal */
+	    /* 
+		Unflushed transactions are replayed if device is writable, or
+		are read over the home locations in overlay mode.
+	    */
+	    if (overlay) {
+		if (!(fs->dal = reiserfs_journal_overlay_open(fs->journal, host_dal))) {
+		    fs->dal = host_dal;
+		    goto error_free_journal;
+		}
+		fs->flags |= FS_JOURNAL_OVERLAY;
+	    } else if ((dal_flags(host_dal) & O_RDWR) && 
+		    !reiserfs_journal_replay(fs->journal, host_dal))
+	    {
+		libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		    _("Couldn't replay the journal."));
+		goto error_free_journal;
+	    }
+		
+	    /* Reopening the superblock that can be logged by the journal */
 	    if (!reiserfs_fs_super_reopen(fs))
 	        goto error_free_fs;
 	}
@@ -1336,7 +1471,7 @@ static reiserfs_fs_t *reiserfs_fs_open_as(dal_t *host_dal, dal_t *journal_dal,
 	libreiserfs_exception_throw(EXCEPTION_WARNING, EXCEPTION_IGNORE, 
 	    _("Journal was not opened. Journal tuning is needed."));
 	
-    if (with_bitmap && !reiserfs_fs_bitmap_open(fs))
+    if (with_bitmap && !reiserfs_fs_bitmap_open_as(fs, bitmap_flags))
 	goto error_free_journal;
 
     if (!reiserfs_fs_tree_open(fs))
@@ -1345,6 +1480,8 @@ static reiserfs_fs_t *reiserfs_fs_open_as(dal_t *host_dal, dal_t *journal_dal,
     return fs;
 	
 error_free_journal:
+    if (reiserfs_fs_journal_overlay(fs))
+	reiserfs_journal_overlay_close(fs->dal);
     if (reiserfs_fs_journal_opened(fs))
 	reiserfs_fs_journal_close(fs);
 error_free_super:
@@ -1356,16 +1493,38 @@ error:
 }
 
 reiserfs_fs_t *reiserfs_fs_open(dal_t *host_dal, dal_t *journal_dal) {
-    return reiserfs_fs_open_as(host_dal, journal_dal, 1); 
+    return reiserfs_fs_open_as(host_dal, journal_dal, 1, 0, 0); 
+}
+
+/* Bitmap blocks are read on demand, see reiserfs_bitmap_open_as */
+reiserfs_fs_t *reiserfs_fs_open_lazy(dal_t *host_dal, dal_t *journal_dal) {
+    return reiserfs_fs_open_as(host_dal, journal_dal, 1, BITMAP_LAZY, 0); 
+}
+
+/* For huge filesystems, bitmap is read on demand and kept compressed */
+reiserfs_fs_t *reiserfs_fs_open_compressed(dal_t *host_dal, dal_t *journal_dal) {
+    return reiserfs_fs_open_as(host_dal, journal_dal, 1, 
+	BITMAP_LAZY | BITMAP_COMPRESSED, 0); 
+}
+
+/* 
+    Read-only view of dirty filesystem. Devices are never written, blocks 
+    logged by unflushed transactions are read from the journal.
+*/
+reiserfs_fs_t *reiserfs_fs_open_overlay(dal_t *host_dal, dal_t *journal_dal) {
+    return reiserfs_fs_open_as(host_dal, journal_dal, 1, 0, 1); 
 }
 
 reiserfs_fs_t *reiserfs_fs_open_fast(dal_t *host_dal, dal_t *journal_dal) {
-    return reiserfs_fs_open_as(host_dal, journal_dal, 0); 
+    return reiserfs_fs_open_as(host_dal, journal_dal, 0, 0, 0); 
 }
 
 int reiserfs_fs_sync(reiserfs_fs_t *fs) {
     ASSERT(fs != NULL, return 0);
 	
+    if (reiserfs_fs_journal_opened(fs) && !reiserfs_journal_flush(fs->journal))
+	return 0;
+	
     if (reiserfs_fs_super_dirty(fs) && !reiserfs_fs_super_sync(fs))
 	return 0;
 	
@@ -1549,6 +1708,11 @@ void reiserfs_fs_close(reiserfs_fs_t *fs) {
     reiserfs_fs_tree_close(fs);
     reiserfs_fs_super_close(fs);
 	
+    if (reiserfs_fs_journal_overlay(fs))
+	reiserfs_journal_overlay_close(fs->dal);
+	
+    reiserfs_object_dcache_invalidate(fs, NULL);
+    reiserfs_object_scache_invalidate(fs, 0);
     libreiserfs_free(fs);
 }
 
@@ -11,6 +11,10 @@
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
 #include <reiserfs/reiserfs.h>
 #include <reiserfs/debug.h>
 
@@ -30,21 +34,40 @@ int reiserfs_dir_stat(reiserfs_dir_t *dir, struct stat *stat) {
     return 1;
 }
 
-reiserfs_dir_t *reiserfs_dir_open(reiserfs_fs_t *fs, const char *name) {
+/* 
+    Opens dir either by name, relative to dirkey if it is given, or directly 
+    by the object key if name is NULL.
+*/
+static reiserfs_dir_t *reiserfs_dir_open_as(reiserfs_fs_t *fs, struct key *dirkey, 
+    const char *name, struct key *key)
+{
     reiserfs_dir_t *dir;
 
     ASSERT(fs != NULL, return NULL);
-    ASSERT(name != NULL, return NULL);
+    ASSERT(name != NULL || key != NULL, return NULL);
 	
     if (!(dir = libreiserfs_calloc(sizeof(*dir), 0)))
 	goto error;
 	
-    if (!(dir->entity = reiserfs_object_create(fs, name, 0)))
+    if (!name)
+	dir->entity = reiserfs_object_create_by_key(fs, key);
+    else if (dirkey)
+	dir->entity = reiserfs_object_create_at(fs, dirkey, name, 0);
+    else
+	dir->entity = reiserfs_object_create(fs, name, 0);
+	
+    if (!dir->entity)
 	goto error_free_dir;
 	
     if (!reiserfs_object_is_dir(dir->entity)) {
-	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
-	    _("Sorry, %s isn't a directory."), name);
+	if (name) {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		_("Sorry, %s isn't a directory."), name);
+	} else {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		_("Sorry, object (%lu %lu) isn't a directory."), 
+		get_key_dirid(key), get_key_objid(key));
+	}
 	goto error_free_entity;
     }
 	
@@ -61,6 +84,36 @@ error:
     return NULL;
 }
 
+reiserfs_dir_t *reiserfs_dir_open(reiserfs_fs_t *fs, const char *name) {
+    return reiserfs_dir_open_as(fs, NULL, name, NULL);
+}
+
+/* Opens dir by name relative to the directory with given key, if any */
+reiserfs_dir_t *reiserfs_dir_open_at(reiserfs_fs_t *fs, struct key *dirkey, 
+    const char *name) 
+{
+    return reiserfs_dir_open_as(fs, dirkey, name, NULL);
+}
+
+/* Opens dir by its dirid and objectid, no path lookup is performed */
+reiserfs_dir_t *reiserfs_dir_open_by_key(reiserfs_fs_t *fs, uint32_t dirid, 
+    uint32_t objid) 
+{
+    struct key key;
+	
+    ASSERT(fs != NULL, return NULL);
+	
+    reiserfs_key_form(&key, dirid, objid, SD_OFFSET, KEY_TYPE_SD, 
+	reiserfs_fs_format(fs));
+	
+    return reiserfs_dir_open_as(fs, NULL, NULL, &key);
+}
+
+struct key *reiserfs_dir_key(reiserfs_dir_t *dir) {
+    ASSERT(dir != NULL, return NULL);
+    return &dir->entity->key;
+}
+
 void reiserfs_dir_close(reiserfs_dir_t *dir) {
     ASSERT(dir != NULL, return);
     ASSERT(dir->entity != NULL, return);
@@ -86,10 +139,87 @@ int reiserfs_dir_rewind(reiserfs_dir_t *dir) {
     return 1;
 }
 
+static int reiserfs_dir_item_key(reiserfs_dir_t *dir, struct key *key) {
+    return !reiserfs_key_comp_two_components(key, &dir->entity->key) && 
+	reiserfs_key_type(key) == KEY_TYPE_DR;
+}
+
+/* 
+    Moves dir cursor to the next item of the dir. The right leaf is reached 
+    by the path, without a lookup from the root. Cursor isn't moved at the 
+    end of dir.
+*/
+static int reiserfs_dir_next_item(reiserfs_dir_t *dir) {
+    struct key *rkey;
+    reiserfs_path_node_t *leaf;
+    reiserfs_item_head_t *item;
+	
+    if (!(leaf = reiserfs_path_last(dir->entity->path)))
+	return 0;
+	
+    if (leaf->pos + 1 < get_node_nritems(get_node_head(leaf->node))) {
+	item = get_ih_item_head(leaf->node, leaf->pos + 1);
+	
+	if (!reiserfs_dir_item_key(dir, &item->ih_key))
+	    return 0;
+	
+	leaf->pos++;
+    } else {
+	if (!(rkey = reiserfs_tree_right_key(dir->entity->path)) || 
+		!reiserfs_dir_item_key(dir, rkey))
+	    return 0;
+	
+	if (!reiserfs_tree_next_leaf(dir->entity->fs->tree, dir->entity->path))
+	    return 0;
+    }
+	
+    dir->local = 0;
+    return 1;
+}
+
+/* 
+    Moves dir cursor to the last entry of the previous item of the dir. When 
+    the cursor is at the first item of a leaf, the left leaf is reached by the 
+    key just before the left delimiting key.
+*/
+static int reiserfs_dir_prev_item(reiserfs_dir_t *dir) {
+    struct key *lkey;
+    reiserfs_path_node_t *leaf;
+    reiserfs_item_head_t *item;
+	
+    if (!(leaf = reiserfs_path_last(dir->entity->path)))
+	return 0;
+	
+    if (leaf->pos == 0) {
+	
+	/* The first item of the dir starts from dot */
+	if (!(lkey = reiserfs_tree_left_key(dir->entity->path)) || 
+		!reiserfs_dir_item_key(dir, lkey) || reiserfs_key_offset(lkey) <= DOT_OFFSET)
+	    return 0;
+	
+	/* Key isn't in the tree, so path points past the last item of left leaf */
+	reiserfs_object_seek_by_offset(dir->entity, reiserfs_key_offset(lkey) - 1, 
+	    KEY_TYPE_DR, reiserfs_key_comp_four_components);
+	
+	if (!(leaf = reiserfs_path_last(dir->entity->path)) || 
+		!is_leaf_node(leaf->node) || leaf->pos == 0)
+	    return 0;
+    }
+	
+    item = get_ih_item_head(leaf->node, leaf->pos - 1);
+	
+    if (!reiserfs_dir_item_key(dir, &item->ih_key))
+	return 0;
+	
+    leaf->pos--;
+    dir->local = get_ih_entry_count(item) - 1;
+	
+    return 1;
+}
+
 int reiserfs_dir_seek(reiserfs_dir_t *dir, uint32_t offset) {
     int direction;
-    struct key key, *rkey;
-    reiserfs_path_node_t *leaf;
+    struct key key;
     reiserfs_item_head_t *item;
 
     ASSERT(dir != NULL, return 0);
@@ -100,28 +230,16 @@ int reiserfs_dir_seek(reiserfs_dir_t *dir, uint32_t offset) {
     direction = (offset > dir->offset);
 	
     while (dir->offset != offset) {
-	leaf = reiserfs_path_last(dir->entity->path);
 	item = reiserfs_path_last_item(dir->entity->path);
 		
-	if ((direction && dir->local >= get_ih_entry_count(item)) || 
-	    (!direction && dir->local < 0)) 
-	{
-	    if (!leaf->parent) break;
-		
-	    rkey = (struct key *)(leaf->parent->node->data + NDHD_SIZE) + 
-		leaf->parent->pos - (direction ? 0 : 1);
-		
-	    if (reiserfs_key_comp_two_components(rkey, &dir->entity->key) ||
-		   reiserfs_key_type(rkey) != KEY_TYPE_DR)
+	if (direction && dir->local >= get_ih_entry_count(item)) {
+	    if (!reiserfs_dir_next_item(dir))
 		break;
-			
-	    if (!reiserfs_object_seek_by_offset(dir->entity, reiserfs_key_offset(rkey), 
-		    KEY_TYPE_DR, reiserfs_key_comp_four_components))
+	} else if (!direction && dir->local < 0) {
+	    if (!reiserfs_dir_prev_item(dir))
 		break;
-			
-		item = reiserfs_path_last_item(dir->entity->path);
-		dir->local = (direction ? 0 : get_ih_entry_count(item) - 1);
-		direction ? dir->offset++ : dir->offset--;
+		
+	    dir->offset--;
 	} else {
 	    uint32_t internal_off;
 			
@@ -208,14 +326,638 @@ int reiserfs_dir_read(reiserfs_dir_t *dir, reiserfs_dir_entry_t *entry) {
 	return 0;
 	
     if (dir->local >= get_ih_entry_count(item)) {
-	if (!reiserfs_dir_seek(dir, dir->offset + 1))
+	if (!reiserfs_dir_next_item(dir))
 	   return 0;
     }	
 	
     return reiserfs_dir_entry_read(dir, entry);
 }
 
+/* 
+    Fills buffer with packed records of as many visible entries as fit and 
+    moves the cursor past them. Buffer should fit DIRENT_MAX_SIZE bytes at 
+    least, smaller one is refused, so zero is returned only at the end of dir.
+*/
+uint32_t reiserfs_dir_read_batch(reiserfs_dir_t *dir, void *buffer, uint32_t size) {
+    char *name;
+    uint32_t filled = 0, len, max_len, reclen;
+	
+    reiserfs_de_head_t *de;
+    reiserfs_dirent_t *dirent;
+    reiserfs_path_node_t *leaf;
+    reiserfs_item_head_t *item;
+	
+    ASSERT(dir != NULL, return 0);
+    ASSERT(buffer != NULL, return 0);
+	
+    if (size < DIRENT_MAX_SIZE(reiserfs_fs_block_size(dir->entity->fs))) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Buffer of %lu bytes is too small for dir reading, %lu is needed."), 
+	    (unsigned long)size, 
+	    (unsigned long)DIRENT_MAX_SIZE(reiserfs_fs_block_size(dir->entity->fs)));
+	return 0;
+    }
+	
+    while ((leaf = reiserfs_path_last(dir->entity->path))) {
+	item = get_ih_item_head(leaf->node, leaf->pos);
+	
+	if (dir->local >= get_ih_entry_count(item)) {
+	    if (!reiserfs_dir_next_item(dir))
+		break;
+	    continue;
+	}
+	
+	de = (reiserfs_de_head_t *)get_ih_item_body(leaf->node, item) + dir->local;
+	
+	if (is_de_visible(de)) {
+	    name = (char *)(de - dir->local) + get_de_location(de);
+	    max_len = reiserfs_dir_entry_name_length(item, de, dir->local);
+	    
+	    /* Names of the new format are padded by zeros */
+	    for (len = 0; len < max_len && name[len]; len++);
+	    
+	    reclen = ROUND_UP(sizeof(*dirent) + len + 1);
+	    
+	    if (filled + reclen > size)
+		break;
+	    
+	    dirent = (reiserfs_dirent_t *)((char *)buffer + filled);
+	    
+	    dirent->d_dirid = get_de_dirid(de);
+	    dirent->d_objid = get_de_objid(de);
+	    dirent->d_offset = get_de_offset(de);
+	    dirent->d_reclen = reclen;
+	    dirent->d_namelen = len;
+	    
+	    memcpy(dirent->d_name, name, len);
+	    dirent->d_name[len] = '\0';
+	    
+	    filled += reclen;
+	}
+	
+	dir->local++;
+	dir->offset++;
+    }
+	
+    return filled;
+}
+
 int reiserfs_dir_entry_hidden(reiserfs_dir_entry_t *entry) {
     return !is_de_visible(&entry->de);
 }
 
+static int reiserfs_dir_plus_comp(const void *plus1, const void *plus2) {
+    reiserfs_de_head_t *de1 = &(*(reiserfs_dir_plus_t **)plus1)->entry.de;
+    reiserfs_de_head_t *de2 = &(*(reiserfs_dir_plus_t **)plus2)->entry.de;
+	
+    if (get_de_dirid(de1) != get_de_dirid(de2))
+	return (get_de_dirid(de1) < get_de_dirid(de2) ? -1 : 1);
+	
+    if (get_de_objid(de1) != get_de_objid(de2))
+	return (get_de_objid(de1) < get_de_objid(de2) ? -1 : 1);
+	
+    return 0;
+}
+
+/* 
+    Reads up to count entries together with their stat data. Stat items of 
+    the batch are looked up in key order sharing one path, so every leaf is 
+    read once per batch. Stat of an entry whose stat data wasn't found is 
+    zeroed. Returns the number of entries read.
+*/
+uint32_t reiserfs_dir_read_plus(reiserfs_dir_t *dir, reiserfs_dir_plus_t *entries, 
+    uint32_t count)
+{
+    struct key key;
+    uint32_t i, readed;
+	
+    reiserfs_fs_t *fs;
+    reiserfs_path_t *path;
+    reiserfs_path_node_t *leaf;
+    reiserfs_item_head_t *item;
+    reiserfs_dir_plus_t **order;
+
+    ASSERT(dir != NULL, return 0);
+    ASSERT(entries != NULL, return 0);
+	
+    for (readed = 0; readed < count; readed++) {
+	if (!reiserfs_dir_read(dir, &entries[readed].entry))
+	    break;
+	
+	memset(&entries[readed].stat, 0, sizeof(entries[readed].stat));
+    }
+	
+    if (readed == 0)
+	return 0;
+	
+    fs = dir->entity->fs;
+	
+    if (!(order = libreiserfs_calloc(readed * sizeof(*order), 0)))
+	return readed;
+	
+    if (!(path = reiserfs_path_create(MAX_HEIGHT)))
+	goto error_free_order;
+	
+    for (i = 0; i < readed; i++)
+	order[i] = &entries[i];
+	
+    qsort(order, readed, sizeof(*order), reiserfs_dir_plus_comp);
+	
+    for (i = 0; i < readed; i++) {
+	reiserfs_key_form(&key, get_de_dirid(&order[i]->entry.de), 
+	    get_de_objid(&order[i]->entry.de), SD_OFFSET, KEY_TYPE_SD, KEY_FORMAT_1);
+	
+	if (!(leaf = reiserfs_tree_lookup_near(fs->tree, 
+		reiserfs_key_comp_four_components, &key, path)))
+	    continue;
+	
+	item = get_ih_item_head(leaf->node, leaf->pos);
+	
+	reiserfs_object_fill_stat(fs, item, get_ih_item_body(leaf->node, item), 
+	    &order[i]->stat);
+    }
+	
+    reiserfs_path_free(path);
+	
+error_free_order:
+    libreiserfs_free(order);
+    return readed;
+}
+
+
+/* 
+    Parallel dir walking. Workers take directories from the queue, list them 
+    with their stat data and queue found subdirectories. In ordered mode the 
+    caller delivers entries depth first in dir order, listing directories 
+    workers didn't get to yet by itself, and workers keep at most 
+    DIR_WALK_AHEAD undelivered listings. Walk function is never called 
+    concurrently.
+*/
+#define DIR_WALK_QUEUED			0
+#define DIR_WALK_LISTING		1
+#define DIR_WALK_LISTED			2
+
+struct reiserfs_walk_node;
+
+struct reiserfs_walk_ent {
+    char *name;
+    uint32_t dirid, objid;
+    struct stat stat;
+	
+    /* Node of subdirectory in ordered mode */
+    struct reiserfs_walk_node *child;
+};
+
+struct reiserfs_walk_node {
+    struct reiserfs_walk_node *next;
+	
+    uint32_t dirid, objid;
+    uint32_t level;
+    int state;
+	
+    struct reiserfs_walk_ent *ents;
+    uint32_t count;
+	
+    char path[];
+};
+
+struct reiserfs_walk_job {
+    reiserfs_fs_t *fs;
+    int flags;
+	
+    reiserfs_dir_walk_func_t walk_func;
+    void *data;
+	
+    struct reiserfs_walk_node *queue;
+    uint32_t busy, ahead;
+    int stop, failed;
+	
+    char path[4096];
+	
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;
+    pthread_mutex_t deliver;
+    pthread_cond_t cond;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+#  define reiserfs_walk_job_lock(job)		pthread_mutex_lock(&(job)->mutex)
+#  define reiserfs_walk_job_unlock(job)		pthread_mutex_unlock(&(job)->mutex)
+#  define reiserfs_walk_job_wait(job)		pthread_cond_wait(&(job)->cond, &(job)->mutex)
+#  define reiserfs_walk_job_wake(job)		pthread_cond_broadcast(&(job)->cond)
+#  define reiserfs_walk_deliver_lock(job)	pthread_mutex_lock(&(job)->deliver)
+#  define reiserfs_walk_deliver_unlock(job)	pthread_mutex_unlock(&(job)->deliver)
+#else
+#  define reiserfs_walk_job_lock(job)
+#  define reiserfs_walk_job_unlock(job)
+#  define reiserfs_walk_job_wait(job)
+#  define reiserfs_walk_job_wake(job)
+#  define reiserfs_walk_deliver_lock(job)
+#  define reiserfs_walk_deliver_unlock(job)
+#endif
+
+static struct reiserfs_walk_node *reiserfs_walk_node_create(const char *dirpath, 
+    const char *name, uint32_t dirid, uint32_t objid, uint32_t level)
+{
+    struct reiserfs_walk_node *node;
+	
+    if (!(node = libreiserfs_calloc(sizeof(*node) + strlen(dirpath) + 
+	    strlen(name) + 2, 0)))
+	return NULL;
+	
+    strcpy(node->path, dirpath);
+	
+    if (*name) {
+	if (!*dirpath || dirpath[strlen(dirpath) - 1] != PATH_SEPARATOR)
+	    node->path[strlen(node->path)] = PATH_SEPARATOR;
+	strcat(node->path, name);
+    }
+	
+    node->dirid = dirid;
+    node->objid = objid;
+    node->level = level;
+	
+    return node;
+}
+
+static void reiserfs_walk_node_free(struct reiserfs_walk_node *node, int recursive) {
+    uint32_t i;
+	
+    for (i = 0; i < node->count; i++) {
+	if (recursive && node->ents[i].child)
+	    reiserfs_walk_node_free(node->ents[i].child, 1);
+	
+	libreiserfs_free(node->ents[i].name);
+    }
+	
+    if (node->ents)
+	libreiserfs_free(node->ents);
+	
+    libreiserfs_free(node);
+}
+
+/* Reads all visible entries of the node's dir together with their stat data */
+static int reiserfs_walk_node_list(struct reiserfs_walk_job *job, 
+    struct reiserfs_walk_node *node)
+{
+    uint32_t i, readed, max = 0;
+    reiserfs_dir_t *dir;
+    reiserfs_dir_plus_t *plus;
+    struct reiserfs_walk_ent *ent;
+	
+    if (!(dir = reiserfs_dir_open_by_key(job->fs, node->dirid, node->objid)))
+	return 0;
+	
+    if (!(plus = libreiserfs_calloc(DIR_WALK_BATCH * sizeof(*plus), 0)))
+	goto error_free_dir;
+	
+    while ((readed = reiserfs_dir_read_plus(dir, plus, DIR_WALK_BATCH))) {
+	for (i = 0; i < readed; i++) {
+	    if (reiserfs_dir_entry_hidden(&plus[i].entry) || 
+		    !strcmp(plus[i].entry.de_name, ".") || 
+		    !strcmp(plus[i].entry.de_name, ".."))
+		continue;
+	    
+	    if (node->count == max) {
+		max = (max ? max * 2 : DIR_WALK_BATCH);
+		
+		if (!libreiserfs_realloc((void **)&node->ents, max * sizeof(*ent)))
+		    goto error_free_plus;
+	    }
+	    
+	    ent = &node->ents[node->count];
+	    memset(ent, 0, sizeof(*ent));
+	    
+	    if (!(ent->name = libreiserfs_calloc(strlen(plus[i].entry.de_name) + 1, 0)))
+		goto error_free_plus;
+	    
+	    strcpy(ent->name, plus[i].entry.de_name);
+	    ent->dirid = get_de_dirid(&plus[i].entry.de);
+	    ent->objid = get_de_objid(&plus[i].entry.de);
+	    memcpy(&ent->stat, &plus[i].stat, sizeof(ent->stat));
+	    
+	    node->count++;
+	}
+    }
+	
+    libreiserfs_free(plus);
+    reiserfs_dir_close(dir);
+	
+    return 1;
+	
+error_free_plus:
+    libreiserfs_free(plus);
+error_free_dir:
+    reiserfs_dir_close(dir);
+    return 0;
+}
+
+/* Calls walk function for an entry of the node, or for the node itself */
+static int reiserfs_walk_deliver(struct reiserfs_walk_job *job, 
+    struct reiserfs_walk_node *node, struct reiserfs_walk_ent *ent, 
+    struct stat *stat)
+{
+    uint32_t len;
+    reiserfs_dir_walk_entry_t entry;
+	
+    len = strlen(node->path);
+	
+    if (len + (ent ? strlen(ent->name) + 1 : 0) >= sizeof(job->path)) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Path of an entry in %s is too long."), node->path);
+	return 0;
+    }
+	
+    strcpy(job->path, node->path);
+    entry.path = job->path;
+    entry.base = len;
+    entry.level = node->level;
+	
+    if (ent) {
+	if (len && job->path[len - 1] != PATH_SEPARATOR)
+	    job->path[len++] = PATH_SEPARATOR;
+	
+	strcpy(job->path + len, ent->name);
+	
+	entry.base = len;
+	entry.level = node->level + 1;
+	entry.dirid = ent->dirid;
+	entry.objid = ent->objid;
+	stat = &ent->stat;
+    } else {
+	while (entry.base > 0 && job->path[entry.base - 1] != PATH_SEPARATOR)
+	    entry.base--;
+	
+	entry.dirid = node->dirid;
+	entry.objid = node->objid;
+    }
+	
+    memcpy(&entry.stat, stat, sizeof(entry.stat));
+	
+    return job->walk_func(&entry, job->data);
+}
+
+/* 
+    Lists the node and queues its subdirs. Unless walking is ordered, entries 
+    are delivered before subdirs are queued, so a dir is always reported 
+    before its content. Called with the job unlocked.
+*/
+static void reiserfs_walk_node_process(struct reiserfs_walk_job *job, 
+    struct reiserfs_walk_node *node)
+{
+    uint32_t i;
+    int ordered, listed;
+    struct reiserfs_walk_ent *ent;
+    struct reiserfs_walk_node *child, *next, *head = NULL, **tail = &head;
+	
+    ordered = job->flags & DIR_WALK_ORDERED;
+    listed = reiserfs_walk_node_list(job, node);
+	
+    for (i = 0; listed && i < node->count; i++) {
+	ent = &node->ents[i];
+	
+	if (!LINUX_S_ISDIR(ent->stat.st_mode))
+	    continue;
+	
+	if (!(child = reiserfs_walk_node_create(node->path, ent->name, 
+		ent->dirid, ent->objid, node->level + 1)))
+	{
+	    listed = 0;
+	    break;
+	}
+	
+	if (ordered)
+	    ent->child = child;
+	
+	*tail = child;
+	tail = &child->next;
+    }
+	
+    if (!ordered) {
+	reiserfs_walk_deliver_lock(job);
+	
+	for (i = 0; i < node->count && !job->stop; i++) {
+	    if (!reiserfs_walk_deliver(job, node, &node->ents[i], NULL)) {
+		reiserfs_walk_job_lock(job);
+		job->stop = 1;
+		reiserfs_walk_job_unlock(job);
+	    }
+	}
+	
+	reiserfs_walk_deliver_unlock(job);
+	reiserfs_walk_node_free(node, 0);
+    }
+	
+    reiserfs_walk_job_lock(job);
+	
+    if (!listed)
+	job->failed = 1;
+	
+    if (job->stop && !ordered) {
+	for (child = head; child; child = next) {
+	    next = child->next;
+	    reiserfs_walk_node_free(child, 0);
+	}
+    } else {
+	/* Subdirs go to the queue head in dir order, so walking goes depth first */
+	*tail = job->queue;
+	job->queue = head;
+    }
+	
+    if (ordered) {
+	node->state = DIR_WALK_LISTED;
+	job->ahead++;
+    }
+	
+    reiserfs_walk_job_wake(job);
+    reiserfs_walk_job_unlock(job);
+}
+
+static void *reiserfs_walk_worker(void *data) {
+    struct reiserfs_walk_node *node;
+    struct reiserfs_walk_job *job = (struct reiserfs_walk_job *)data;
+	
+    reiserfs_walk_job_lock(job);
+	
+    while (!job->stop) {
+	if ((node = job->queue) && (!(job->flags & DIR_WALK_ORDERED) || 
+	    job->ahead + job->busy < DIR_WALK_AHEAD))
+	{
+	    job->queue = node->next;
+	    node->state = DIR_WALK_LISTING;
+	    job->busy++;
+	    
+	    reiserfs_walk_job_unlock(job);
+	    reiserfs_walk_node_process(job, node);
+	    reiserfs_walk_job_lock(job);
+	    
+	    job->busy--;
+	    reiserfs_walk_job_wake(job);
+	    continue;
+	}
+	
+	/* Nothing is queued and nobody can queue more */
+	if (!job->queue && !job->busy && !(job->flags & DIR_WALK_ORDERED))
+	    break;
+	
+#ifdef HAVE_PTHREAD
+	reiserfs_walk_job_wait(job);
+#else
+	break;
+#endif
+    }
+	
+    reiserfs_walk_job_unlock(job);
+	
+    return NULL;
+}
+
+/* Delivers node entries depth first, waiting for or doing needed listings */
+static int reiserfs_walk_ordered(struct reiserfs_walk_job *job, 
+    struct reiserfs_walk_node *node)
+{
+    uint32_t i;
+    struct reiserfs_walk_node **prev;
+	
+    reiserfs_walk_job_lock(job);
+	
+    while (node->state != DIR_WALK_LISTED) {
+	if (node->state == DIR_WALK_QUEUED) {
+	    for (prev = &job->queue; *prev != node; prev = &(*prev)->next);
+	    
+	    *prev = node->next;
+	    node->state = DIR_WALK_LISTING;
+	    
+	    reiserfs_walk_job_unlock(job);
+	    reiserfs_walk_node_process(job, node);
+	    reiserfs_walk_job_lock(job);
+	} else
+	    reiserfs_walk_job_wait(job);
+    }
+	
+    reiserfs_walk_job_unlock(job);
+	
+    for (i = 0; i < node->count; i++) {
+	if (!reiserfs_walk_deliver(job, node, &node->ents[i], NULL))
+	    return 0;
+	
+	if (node->ents[i].child) {
+	    if (!reiserfs_walk_ordered(job, node->ents[i].child))
+		return 0;
+	    
+	    node->ents[i].child = NULL;
+	}
+    }
+	
+    reiserfs_walk_job_lock(job);
+    job->ahead--;
+    reiserfs_walk_job_wake(job);
+    reiserfs_walk_job_unlock(job);
+	
+    reiserfs_walk_node_free(node, 0);
+	
+    return 1;
+}
+
+/* 
+    Walks the dir hierarchy under root, calling walk_func for root and for 
+    every entry below it with its path and stat data. Symlinks aren't 
+    followed. Walking stops as soon as walk_func returns zero. Without 
+    DIR_WALK_ORDERED the order of entries depends on workers timing. Returns 
+    zero if walking was stopped or some dir couldn't be read.
+*/
+int reiserfs_dir_walk(reiserfs_fs_t *fs, const char *root, int flags, 
+    reiserfs_dir_walk_func_t walk_func, void *data) 
+{
+    int done;
+    reiserfs_dir_t *dir;
+    struct reiserfs_walk_job job;
+    struct reiserfs_walk_node *node, *next;
+#ifdef HAVE_PTHREAD
+    uint32_t i, started = 0;
+    pthread_t *workers;
+#endif
+	
+    ASSERT(fs != NULL, return 0);
+    ASSERT(root != NULL, return 0);
+    ASSERT(walk_func != NULL, return 0);
+	
+    if (!(dir = reiserfs_dir_open(fs, root)))
+	return 0;
+	
+    memset(&job, 0, sizeof(job));
+	
+    job.fs = fs;
+    job.flags = flags;
+    job.walk_func = walk_func;
+    job.data = data;
+	
+    if (!(node = reiserfs_walk_node_create(root, "", 
+	    get_key_dirid(&dir->entity->key), get_key_objid(&dir->entity->key), 0)))
+	goto error_free_dir;
+	
+    if (!reiserfs_walk_deliver(&job, node, NULL, &dir->entity->stat)) {
+	reiserfs_walk_node_free(node, 0);
+	goto error_free_dir;
+    }
+	
+    reiserfs_dir_close(dir);
+    job.queue = node;
+	
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_mutex_init(&job.deliver, NULL);
+    pthread_cond_init(&job.cond, NULL);
+	
+    if ((workers = libreiserfs_calloc(DIR_WALK_THREADS * sizeof(*workers), 0))) {
+	for (i = 1; i < DIR_WALK_THREADS; i++, started++) {
+	    if (pthread_create(&workers[started], NULL, 
+		    reiserfs_walk_worker, &job))
+		break;
+	}
+    }
+#endif
+	
+    /* Calling thread either delivers ordered entries or is a worker too */
+    if (flags & DIR_WALK_ORDERED) {
+	done = reiserfs_walk_ordered(&job, node);
+	
+	reiserfs_walk_job_lock(&job);
+	job.stop = 1;
+	reiserfs_walk_job_wake(&job);
+	reiserfs_walk_job_unlock(&job);
+    } else {
+	reiserfs_walk_worker(&job);
+	done = !job.stop;
+    }
+	
+#ifdef HAVE_PTHREAD
+    for (i = 0; i < started; i++)
+	pthread_join(workers[i], NULL);
+	
+    if (workers)
+	libreiserfs_free(workers);
+	
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.deliver);
+    pthread_mutex_destroy(&job.mutex);
+#endif
+	
+    /* Dropping whatever was left undelivered after a stop */
+    if (flags & DIR_WALK_ORDERED) {
+	if (!done)
+	    reiserfs_walk_node_free(node, 1);
+    } else {
+	for (node = job.queue; node; node = next) {
+	    next = node->next;
+	    reiserfs_walk_node_free(node, 0);
+	}
+    }
+	
+    return done && !job.failed;
+	
+error_free_dir:
+    reiserfs_dir_close(dir);
+    return 0;
+}
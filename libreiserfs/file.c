@@ -11,6 +11,10 @@
 #include <string.h>
 #include <fcntl.h>
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
 #include <reiserfs/reiserfs.h>
 #include <reiserfs/debug.h>
 
@@ -22,13 +26,17 @@
 #  define _(String) (String)
 #endif
 
-static reiserfs_file_t *reiserfs_file_open_as(reiserfs_fs_t *fs, const char *name, 
-    int mode, int as_link)
+/* 
+    Opens file either by name, relative to dirkey if it is given, or directly 
+    by the object key if name is NULL.
+*/
+static reiserfs_file_t *reiserfs_file_open_as(reiserfs_fs_t *fs, struct key *dirkey, 
+    const char *name, struct key *key, int mode, int as_link)
 {
     reiserfs_file_t *file;
 	
     ASSERT(fs != NULL, return NULL);
-    ASSERT(name != NULL, return NULL);
+    ASSERT(name != NULL || key != NULL, return NULL);
 
     if (dal_flags(fs->dal) & O_RDONLY && mode & O_RDWR) {
 	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
@@ -39,14 +47,27 @@ static reiserfs_file_t *reiserfs_file_open_as(reiserfs_fs_t *fs, const char *nam
     if (!(file = libreiserfs_calloc(sizeof(*file), 0)))
 	return NULL;
 
-    if (!(file->entity = reiserfs_object_create(fs, name, as_link)))
+    if (!name)
+	file->entity = reiserfs_object_create_by_key(fs, key);
+    else if (dirkey)
+	file->entity = reiserfs_object_create_at(fs, dirkey, name, as_link);
+    else
+	file->entity = reiserfs_object_create(fs, name, as_link);
+	
+    if (!file->entity)
 	goto error_free_file;
 
     if (!reiserfs_object_is_reg(file->entity) && 
 	!reiserfs_object_is_lnk(file->entity)) 
     {
-	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
-	    _("Sorry, %s isn't a regular file or link to file."), name);
+	if (name) {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		_("Sorry, %s isn't a regular file or link to file."), name);
+	} else {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		_("Sorry, object (%lu %lu) isn't a regular file or link to file."), 
+		get_key_dirid(key), get_key_objid(key));
+	}
 	goto error_free_entity;
     }
 	
@@ -66,122 +87,532 @@ error:
 }    
 
 reiserfs_file_t *reiserfs_file_open(reiserfs_fs_t *fs, const char *name, int mode) {
-    return reiserfs_file_open_as(fs, name, mode, 0);
+    return reiserfs_file_open_as(fs, NULL, name, NULL, mode, 0);
 }
 
 reiserfs_file_t *reiserfs_link_open(reiserfs_fs_t *fs, const char *name, int mode) {
-    return reiserfs_file_open_as(fs, name, mode, 1);
+    return reiserfs_file_open_as(fs, NULL, name, NULL, mode, 1);
+}
+
+/* Opens file by name relative to the directory with given key, if any */
+reiserfs_file_t *reiserfs_file_open_at(reiserfs_fs_t *fs, struct key *dirkey, 
+    const char *name, int mode) 
+{
+    return reiserfs_file_open_as(fs, dirkey, name, NULL, mode, 0);
+}
+
+reiserfs_file_t *reiserfs_link_open_at(reiserfs_fs_t *fs, struct key *dirkey, 
+    const char *name, int mode) 
+{
+    return reiserfs_file_open_as(fs, dirkey, name, NULL, mode, 1);
+}
+
+/* Opens file by its dirid and objectid, no path lookup is performed */
+reiserfs_file_t *reiserfs_file_open_by_key(reiserfs_fs_t *fs, uint32_t dirid, 
+    uint32_t objid, int mode) 
+{
+    struct key key;
+	
+    ASSERT(fs != NULL, return NULL);
+	
+    reiserfs_key_form(&key, dirid, objid, SD_OFFSET, KEY_TYPE_SD, 
+	reiserfs_fs_format(fs));
+	
+    return reiserfs_file_open_as(fs, NULL, NULL, &key, mode, 0);
 }
 
 void reiserfs_file_close(reiserfs_file_t *file) {
     ASSERT(file != NULL, return);
     ASSERT(file->entity != NULL, return);
 
+    if (file->extents)
+	libreiserfs_free(file->extents);
+	
     reiserfs_object_free(file->entity);
     libreiserfs_free(file);
 }
 
-static int reiserfs_file_read_direct(reiserfs_file_t *file, void *buffer, 
-    uint64_t size)
+static int reiserfs_file_extent_add(reiserfs_file_t *file, uint32_t type, 
+    uint64_t offset, uint64_t size, blk_t start, uint32_t body)
 {
-    uint32_t chunk, offset;
+    uint64_t end = 0;
+    reiserfs_file_extent_t *last = NULL;
+
+    if (file->extents_count > 0) {
+	last = &file->extents[file->extents_count - 1];
+	end = last->offset + last->size;
+    }
+
+    if (offset < end) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Item of file (%lu %lu) at %llu overlaps the previous one."), 
+	    get_key_dirid(&file->entity->key), get_key_objid(&file->entity->key), 
+	    offset);
+	return 0;
+    }
+
+    /* Gaps between items are holes */
+    if (offset > end) {
+	if (!reiserfs_file_extent_add(file, FILE_EXTENT_HOLE, end, offset - end, 0, 0))
+	    return 0;
+	
+	last = &file->extents[file->extents_count - 1];
+    }
+
+    if (last && last->type == type) {
+	if (type == FILE_EXTENT_HOLE || (type == FILE_EXTENT_BLOCKS && 
+	    last->start + last->size / reiserfs_fs_block_size(file->entity->fs) == start))
+	{
+	    last->size += size;
+	    return 1;
+	}
+    }
+
+    if (file->extents_count == file->extents_max) {
+	if (!libreiserfs_realloc((void **)&file->extents, 
+		file->extents_max * 2 * sizeof(*file->extents)))
+	    return 0;
+	
+	file->extents_max *= 2;
+    }
+    
+    last = &file->extents[file->extents_count++];
+	
+    last->type = type;
+    last->offset = offset;
+    last->size = size;
+    last->start = start;
+    last->body = body;
+	
+    return 1;
+}
+
+/* Builds extent map by walking file items once from the stat data on */
+static int reiserfs_file_map_build(reiserfs_file_t *file) {
+    struct key key;
+    uint32_t i, blocksize, *blocks;
+    uint64_t offset, end;
+	
+    reiserfs_fs_t *fs;
+    reiserfs_path_t *path;
     reiserfs_path_node_t *leaf;
     reiserfs_item_head_t *item;
+
+    fs = file->entity->fs;
+    blocksize = reiserfs_fs_block_size(fs);
 	
-    leaf = reiserfs_path_last(file->entity->path);
-    item = get_ih_item_head(leaf->node, leaf->pos);
+    file->extents_count = 0;
+    file->extents_max = 16;
 	
-    if ((chunk = get_ih_item_len(item) - file->offset_dt) == 0)
-	return 1;
+    if (!(file->extents = libreiserfs_calloc(file->extents_max * 
+	    sizeof(*file->extents), 0)))
+	return 0;
 	
-    if (chunk > size) chunk = size;
+    if (!(path = reiserfs_path_create(MAX_HEIGHT)))
+	goto error_free_extents;
 	
-    memcpy(buffer, get_ih_item_body(leaf->node, item) + file->offset_dt, chunk);
+    reiserfs_key_form(&key, get_key_dirid(&file->entity->key), 
+	get_key_objid(&file->entity->key), SD_OFFSET, KEY_TYPE_SD, KEY_FORMAT_1);
 	
-    file->offset += chunk;
-    file->offset_dt += chunk;
+    if (!(leaf = reiserfs_tree_lookup_leaf(fs->tree, reiserfs_tree_get_root(fs->tree), 
+	reiserfs_key_comp_four_components, &key, path)))
+    {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Couldn't find stat data of file (%lu %lu)."), 
+	    get_key_dirid(&key), get_key_objid(&key));
+	goto error_free_path;
+    }
+	
+    while (leaf) {
+	for (; leaf->pos < get_node_nritems(get_node_head(leaf->node)); leaf->pos++) {
+	    item = get_ih_item_head(leaf->node, leaf->pos);
+	    
+	    if (reiserfs_key_comp_two_components(&item->ih_key, &key) != 0)
+		goto done;
+
+	    offset = reiserfs_key_offset(&item->ih_key) - 1;
+	    
+	    switch (reiserfs_key_type(&item->ih_key)) {
+		case KEY_TYPE_DT: {
+		    if (!reiserfs_file_extent_add(file, FILE_EXTENT_DIRECT, offset, 
+			    get_ih_item_len(item), reiserfs_block_get_nr(leaf->node), 
+			    get_ih_item_location(item)))
+			goto error_free_path;
+		    break;
+		}
+		case KEY_TYPE_IT: {
+		    blocks = (uint32_t *)get_ih_item_body(leaf->node, item);
+		    
+		    for (i = 0; i < get_ih_unfm_nr(item); i++, offset += blocksize) {
+			if (!reiserfs_file_extent_add(file, (blocks[i] ? 
+				FILE_EXTENT_BLOCKS : FILE_EXTENT_HOLE), offset, blocksize, 
+				LE32_TO_CPU(blocks[i]), 0))
+			    goto error_free_path;
+		    }
+		    break;
+		}
+	    }
+	}
+	
+	leaf = reiserfs_tree_next_leaf(fs->tree, path);
+    }
+	
+done:
+    reiserfs_path_free(path);
+	
+    /* Tail of the file not covered by items is a hole too */
+    end = (file->extents_count > 0 ? file->extents[file->extents_count - 1].offset + 
+	file->extents[file->extents_count - 1].size : 0);
+	
+    if (end < file->size) {
+	if (!reiserfs_file_extent_add(file, FILE_EXTENT_HOLE, end, file->size - end, 0, 0))
+	    goto error_free_extents;
+    }
 	
     return 1;
+	
+error_free_path:
+    reiserfs_path_free(path);
+error_free_extents:
+    libreiserfs_free(file->extents);
+    file->extents = NULL;
+    return 0;
 }
 
-static uint64_t reiserfs_file_read_indirect(reiserfs_file_t *file, void *buffer, 
-    uint64_t size)
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t reiserfs_file_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Map is built once, readers sharing the file may come here concurrently */
+static int reiserfs_file_map(reiserfs_file_t *file) {
+    int result = 1;
+	
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&reiserfs_file_map_mutex);
+#endif
+	
+    if (!file->extents)
+	result = reiserfs_file_map_build(file);
+	
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&reiserfs_file_map_mutex);
+#endif
+	
+    return result;
+}
+
+static reiserfs_file_extent_t *reiserfs_file_extent_find(reiserfs_file_t *file, 
+    uint64_t offset)
 {
-    uint64_t readed = 0;
-    uint32_t *blocks, offset, chunk;
+    uint32_t left = 0, right = file->extents_count, middle;
 	
-    reiserfs_path_node_t *leaf;
-    reiserfs_item_head_t *item;
+    while (left < right) {
+	middle = (left + right) / 2;
 	
-    leaf = reiserfs_path_last(file->entity->path);
-    item = get_ih_item_head(leaf->node, leaf->pos);
+	if (offset < file->extents[middle].offset)
+	    right = middle;
+	else if (offset >= file->extents[middle].offset + file->extents[middle].size)
+	    left = middle + 1;
+	else
+	    return &file->extents[middle];
+    }
 	
-    blocks = (uint32_t *)get_ih_item_body(leaf->node, item);
+    return NULL;
+}
+
+static int reiserfs_file_read_direct(reiserfs_file_t *file, 
+    reiserfs_file_extent_t *extent, uint64_t offset, void *buffer, uint64_t size)
+{
+    reiserfs_block_t *leaf;
 	
-    for (; file->offset_it < get_ih_unfm_nr(item) && readed < size; file->offset_it++) {
-	reiserfs_block_t *block;
+    if (!(leaf = reiserfs_block_read(file->entity->fs->dal, extent->start))) {
+	reiserfs_block_reading_failed(extent->start, 
+	    dal_error(file->entity->fs->dal), return 0);
+    }
 	
-	if (blocks[file->offset_it] == 0) 
-	    continue;
+    memcpy(buffer, leaf->data + extent->body + (offset - extent->offset), size);
 	
-	if (!(block = reiserfs_block_read(file->entity->fs->dal, 
-	    blocks[file->offset_it]))) 
-	{
-	    reiserfs_block_reading_failed(blocks[file->offset_it], 
-		dal_error(file->entity->fs->dal), return 0);
-	}
-	    
-	offset = file->offset % reiserfs_fs_block_size(file->entity->fs);
-	chunk = reiserfs_fs_block_size(file->entity->fs) - offset;
+    reiserfs_block_free(leaf);
+    return 1;
+}
 
-	if (chunk > size - readed)
-	    chunk = size - readed;
-	    
-	memcpy(buffer, block->data + offset, chunk);
-	    
-	reiserfs_block_free(block);
+/* 
+    Reads part of a run of unformatted blocks. Whole blocks are read straight 
+    into the caller's buffer by large requests, unaligned head and tail go 
+    through the bounce block.
+*/
+static int reiserfs_file_read_indirect(reiserfs_file_t *file, 
+    reiserfs_file_extent_t *extent, uint64_t offset, void *buffer, uint64_t size)
+{
+    dal_t *dal;
+    blk_t blk;
+    count_t count;
+    char *bounce = NULL;
+    uint64_t readed = 0, pos;
+    uint32_t blocksize, chunk;
+	
+    dal = file->entity->fs->dal;
+    blocksize = reiserfs_fs_block_size(file->entity->fs);
+	
+    pos = offset - extent->offset;
+    blk = extent->start + pos / blocksize;
+	
+    if ((pos %= blocksize) || size < blocksize) {
+	if (!(bounce = libreiserfs_malloc(blocksize)))
+	    return 0;
+	
+	if (!dal_read(dal, bounce, blk, 1))
+	    reiserfs_block_reading_failed(blk, dal_error(dal), goto error_free_bounce);
+	
+	chunk = blocksize - pos;
+	
+	if (chunk > size)
+	    chunk = size;
+	
+	memcpy(buffer, bounce + pos, chunk);
 	
-	buffer += chunk;
 	readed += chunk;
-	file->offset += chunk;
+	blk++;
+    }
+	
+    while ((count = (size - readed) / blocksize) > 0) {
+	if (count > FILE_READ_RUN_MAX)
+	    count = FILE_READ_RUN_MAX;
+	
+	if (!dal_read(dal, buffer + readed, blk, count))
+	    reiserfs_block_reading_failed(blk, dal_error(dal), goto error_free_bounce);
+	
+	readed += (uint64_t)count * blocksize;
+	blk += count;
+    }
+	
+    if (readed < size) {
+	if (!bounce && !(bounce = libreiserfs_malloc(blocksize)))
+	    return 0;
+	
+	if (!dal_read(dal, bounce, blk, 1))
+	    reiserfs_block_reading_failed(blk, dal_error(dal), goto error_free_bounce);
+	
+	memcpy(buffer + readed, bounce, size - readed);
     }
+	
+    if (bounce)
+	libreiserfs_free(bounce);
+	
     return 1;
+	
+error_free_bounce:
+    if (bounce)
+	libreiserfs_free(bounce);
+	
+    return 0;
 }    
 
-static int reiserfs_file_read_item(reiserfs_file_t *file, void *buffer, 
-    uint64_t size)
+static int reiserfs_file_read_extent(reiserfs_file_t *file, 
+    reiserfs_file_extent_t *extent, uint64_t offset, void *buffer, uint64_t size)
 {
-    int result = 0;
-    reiserfs_item_head_t *item = reiserfs_path_last_item(file->entity->path);
+    switch (extent->type) {
+	case FILE_EXTENT_DIRECT:
+	    return reiserfs_file_read_direct(file, extent, offset, buffer, size);
+	case FILE_EXTENT_BLOCKS:
+	    return reiserfs_file_read_indirect(file, extent, offset, buffer, size);
+	default:
+	    memset(buffer, 0, size);
+	    return 1;
+    }
+}
 
-    if (reiserfs_key_type(&item->ih_key) == KEY_TYPE_DT)
-	result = reiserfs_file_read_direct(file, buffer, size);
-    else
-	result = reiserfs_file_read_indirect(file, buffer, size);
+/* 
+    Reads size bytes at offset. Only the stat data and the extent map of the 
+    file are used, so one file may be read by several threads at once.
+*/
+uint64_t reiserfs_file_pread(reiserfs_file_t *file, void *buffer, 
+    uint64_t size, uint64_t offset)
+{
+    uint64_t readed = 0, chunk;
+    reiserfs_file_extent_t *extent;
+	
+    ASSERT(file != NULL, return 0);
+    ASSERT(buffer != NULL, return 0);
+	
+    if (offset >= file->size)
+	return readed;
+	
+    if (!reiserfs_file_map(file))
+	return readed;
+	
+    if (size > file->size - offset)
+	size = file->size - offset;
 	
-    return result;	    
+    while (readed < size) {
+	if (!(extent = reiserfs_file_extent_find(file, offset + readed)))
+	    break;
+	
+	chunk = extent->offset + extent->size - (offset + readed);
+	
+	if (chunk > size - readed)
+	    chunk = size - readed;
+	
+	if (!reiserfs_file_read_extent(file, extent, offset + readed, 
+		buffer + readed, chunk))
+	    break;
+	
+	readed += chunk;
+    }
+	
+    return readed;
 }
 
 uint64_t reiserfs_file_read(reiserfs_file_t *file, void *buffer, uint64_t size) {
-    uint64_t readed = 0, offset;
+    uint64_t readed;
 	
     ASSERT(file != NULL, return 0);
     ASSERT(buffer != NULL, return 0);
 	
-    if (file->offset >= file->size)
-	return readed;
+    readed = reiserfs_file_pread(file, buffer, size, file->offset);
+    file->offset += readed;
+	
+    return readed;
+}
+
+/* 
+    Parallel read job. Workers take the next slice of the requested range 
+    under the lock and read it into their part of the buffer unlocked.
+*/
+struct reiserfs_file_job {
+    reiserfs_file_t *file;
+    char *buffer;
+	
+    uint64_t start, end;
+    uint64_t cursor;
+	
+    /* Lowest offset reading failed at, end if none */
+    uint64_t failed;
+	
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+#  define reiserfs_file_job_lock(job)	pthread_mutex_lock(&(job)->mutex)
+#  define reiserfs_file_job_unlock(job)	pthread_mutex_unlock(&(job)->mutex)
+#else
+#  define reiserfs_file_job_lock(job)
+#  define reiserfs_file_job_unlock(job)
+#endif
+
+static void *reiserfs_file_read_worker(void *data) {
+    uint64_t offset, size, slice;
+    reiserfs_file_extent_t *extent;
+    struct reiserfs_file_job *job = (struct reiserfs_file_job *)data;
+	
+    slice = (uint64_t)FILE_READ_SLICE * reiserfs_fs_block_size(job->file->entity->fs);
+	
+    while (1) {
+	reiserfs_file_job_lock(job);
+	
+	if ((offset = job->cursor) >= job->failed) {
+	    reiserfs_file_job_unlock(job);
+	    break;
+	}
+	
+	if (!(extent = reiserfs_file_extent_find(job->file, offset))) {
+	    job->failed = offset;
+	    reiserfs_file_job_unlock(job);
+	    break;
+	}
 	
-    offset = file->offset;
-    while (readed < size && reiserfs_file_seek(file, file->offset)) {
+	size = extent->offset + extent->size - offset;
 	
-	if (!reiserfs_file_read_item(file, buffer + readed, size - readed))
-	    return readed;
+	if (size > slice)
+	    size = slice;
 	
-	readed += file->offset - offset;
-	offset = file->offset;
+	if (size > job->end - offset)
+	    size = job->end - offset;
+	
+	job->cursor += size;
+	reiserfs_file_job_unlock(job);
+	
+	if (!reiserfs_file_read_extent(job->file, extent, offset, 
+	    job->buffer + (offset - job->start), size))
+	{
+	    reiserfs_file_job_lock(job);
+	    
+	    if (offset < job->failed)
+		job->failed = offset;
+	    
+	    reiserfs_file_job_unlock(job);
+	    break;
+	}
     }
 	
-    return readed;
+    return NULL;
+}
+
+/* 
+    Reads size bytes at offset by up to threads workers (FILE_READ_THREADS 
+    if zero), each of them filling its slice of the buffer. File offset is 
+    not changed. Returns the number of bytes read contiguously from offset.
+*/
+uint64_t reiserfs_file_pread_parallel(reiserfs_file_t *file, void *buffer, 
+    uint64_t size, uint64_t offset, uint32_t threads)
+{
+    struct reiserfs_file_job job;
+#ifdef HAVE_PTHREAD
+    uint32_t i, started = 0;
+    pthread_t *workers;
+#endif
+	
+    ASSERT(file != NULL, return 0);
+    ASSERT(buffer != NULL, return 0);
+	
+    if (offset >= file->size)
+	return 0;
+	
+    /* Map is built here, so workers only read it */
+    if (!reiserfs_file_map(file))
+	return 0;
+	
+    if (size > file->size - offset)
+	size = file->size - offset;
+	
+    if (threads == 0)
+	threads = FILE_READ_THREADS;
+	
+    memset(&job, 0, sizeof(job));
+	
+    job.file = file;
+    job.buffer = buffer;
+    job.start = job.cursor = offset;
+    job.end = job.failed = offset + size;
+	
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&job.mutex, NULL);
+	
+    if ((workers = libreiserfs_calloc(threads * sizeof(*workers), 0))) {
+	for (i = 1; i < threads; i++, started++) {
+	    if (pthread_create(&workers[started], NULL, 
+		    reiserfs_file_read_worker, &job))
+		break;
+	}
+    }
+	
+    /* Calling thread is a worker too */
+    reiserfs_file_read_worker(&job);
+	
+    for (i = 0; i < started; i++)
+	pthread_join(workers[i], NULL);
+	
+    if (workers)
+	libreiserfs_free(workers);
+	
+    pthread_mutex_destroy(&job.mutex);
+#else
+    reiserfs_file_read_worker(&job);
+#endif
+	
+    return job.failed - offset;
 }
 
 uint64_t reiserfs_file_size(reiserfs_file_t *file) {
@@ -200,25 +631,9 @@ uint32_t reiserfs_file_inode(reiserfs_file_t *file) {
 }
 
 int reiserfs_file_rewind(reiserfs_file_t *file) {
-    uint32_t key_type;
-	
     ASSERT(file != NULL, return 0);
 	
-    key_type = (file->size > 
-	MAX_DIRECT_ITEM_LEN(reiserfs_fs_block_size(file->entity->fs)) ? 
-	KEY_TYPE_IT : KEY_TYPE_DT);
-	
-    if (!reiserfs_object_seek_by_offset(file->entity, 1, key_type, 
-	reiserfs_key_comp_four_components))
-    {
-	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL,
-	    _("Couldn't find first file block."));
-	return 0;
-    }
-	
     file->offset = 0;
-    file->offset_dt = 0;
-    file->offset_it = 0;
     return 1;
 }
 
@@ -231,40 +646,105 @@ int reiserfs_file_stat(reiserfs_file_t *file, struct stat *stat) {
 }
 
 int reiserfs_file_seek(reiserfs_file_t *file, uint64_t offset) {
-    uint64_t delta = 0;
-    uint32_t block_pos;
+    ASSERT(file != NULL, return 0);
+	
+    if (offset >= file->size)
+	return 0;
+	
+    if (!reiserfs_file_map(file))
+	return 0;
+	
+    if (!reiserfs_file_extent_find(file, offset))
+	return 0;
+    
+    file->offset = offset;
+    return 1;
+}
 
-    reiserfs_path_node_t *leaf;
-    reiserfs_item_head_t *item;
+/* 
+    Fills at most count extents of the file starting from the one offset lies 
+    in. Direct extents report the leaf the tail lies in. Returns the number 
+    of extents filled.
+*/
+uint32_t reiserfs_file_extents(reiserfs_file_t *file, uint64_t offset, 
+    reiserfs_file_extent_t *extents, uint32_t count)
+{
+    uint32_t i, filled = 0;
+    reiserfs_file_extent_t *extent;
 	
     ASSERT(file != NULL, return 0);
+    ASSERT(extents != NULL, return 0);
+	
     if (offset >= file->size)
 	return 0;
 	
-    item = reiserfs_path_last_item(file->entity->path);
+    if (!reiserfs_file_map(file))
+	return 0;
 	
-    if (file->offset_it >= get_ih_unfm_nr(item))
+    if (!(extent = reiserfs_file_extent_find(file, offset)))
 	return 0;
-
-    if (!(leaf = reiserfs_object_seek_by_offset(file->entity, offset + 1, 0, 
-	reiserfs_key_comp_three_components)))
-    {
-	leaf = reiserfs_path_last(file->entity->path);
-	leaf->pos--;
+	
+    for (i = extent - file->extents; i < file->extents_count && filled < count; i++) {
+	if (file->extents[i].offset >= file->size)
+	    break;
+	
+	memcpy(&extents[filled], &file->extents[i], sizeof(*extents));
+	
+	/* Last block of the file is mapped as a whole */
+	if (extents[filled].offset + extents[filled].size > file->size)
+	    extents[filled].size = file->size - extents[filled].offset;
+	
+	filled++;
     }
+	
+    return filled;
+}
 
-    item = reiserfs_path_last_item(file->entity->path);
-
-    if (reiserfs_key_comp_two_components(&item->ih_key, &file->entity->key) != 0)
+static int reiserfs_file_seek_extent(reiserfs_file_t *file, uint64_t offset, 
+    int hole)
+{
+    uint32_t i;
+    reiserfs_file_extent_t *extent;
+	
+    ASSERT(file != NULL, return 0);
+	
+    if (offset >= file->size)
+	return 0;
+	
+    if (!reiserfs_file_map(file))
+	return 0;
+	
+    if (!(extent = reiserfs_file_extent_find(file, offset)))
 	return 0;
-    
-    file->offset = offset;
-    delta = (offset > (uint64_t)reiserfs_key_offset(&item->ih_key) ?
-	offset - reiserfs_key_offset(&item->ih_key) : 0);
 	
-    file->offset_it = (uint32_t)(delta / reiserfs_fs_block_size(file->entity->fs));
-    file->offset_dt = delta;
+    for (i = extent - file->extents; i < file->extents_count; i++) {
+	extent = &file->extents[i];
 	
-    return 1;
+	if (extent->offset >= file->size)
+	    break;
+	
+	if ((extent->type == FILE_EXTENT_HOLE) == hole) {
+	    file->offset = (offset > extent->offset ? offset : extent->offset);
+	    return 1;
+	}
+    }
+	
+    /* There is an implicit hole at the end of file */
+    if (hole) {
+	file->offset = file->size;
+	return 1;
+    }
+	
+    return 0;
+}
+
+/* Seeks to the first data byte at offset or after it (SEEK_DATA) */
+int reiserfs_file_seek_data(reiserfs_file_t *file, uint64_t offset) {
+    return reiserfs_file_seek_extent(file, offset, 0);
+}
+
+/* Seeks to the first hole byte at offset or after it (SEEK_HOLE) */
+int reiserfs_file_seek_hole(reiserfs_file_t *file, uint64_t offset) {
+    return reiserfs_file_seek_extent(file, offset, 1);
 }
 
@@ -11,7 +11,9 @@
 #  include <config.h>
 #endif
 
+#include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 
 #include <reiserfs/reiserfs.h>
 #include <reiserfs/debug.h>
@@ -54,44 +56,138 @@ static blk_t reiserfs_journal_desc_next(reiserfs_journal_head_t *head, reiserfs_
     return reiserfs_journal_desc_prop(head, desc, JOURNAL_DESC_NEXT);
 }
 
-static int reiserfs_journal_desc_block(reiserfs_block_t *desc) {
-    if (!memcmp(get_jd_magic(desc, dal_get_blocksize(desc->dal)), JOURNAL_DESC_SIGN, 8) && 
-	    LE32_TO_CPU(*((uint32_t *)(desc->data + 4))) > 0)
+static int reiserfs_journal_desc_data(char *data, size_t blocksize) {
+    if (!memcmp(data + blocksize - 12, JOURNAL_DESC_SIGN, 8) && 
+	    LE32_TO_CPU(*((uint32_t *)(data + 4))) > 0)
 	return 1;
 	
     return 0;
 }
 
 /* 
-    Checking whether given transaction is valid. Transaction is 
-    valid if his description block is valid, commit block is valid 
-    and commit block matches description block.
+    Sequential journal scanner. Journal area is read in growing chunks into 
+    a ring buffer, so descriptors are recognized in memory and commit blocks 
+    are usually resident already. Going backward (journal wrap) or far ahead 
+    restarts the window there.
+*/
+struct reiserfs_journal_scan {
+    reiserfs_journal_t *journal;
+    char *ring;
+    blk_t lo, hi;
+    count_t ahead;
+};
+
+static int reiserfs_journal_scan_init(struct reiserfs_journal_scan *scan, 
+    reiserfs_journal_t *journal) 
+{
+    memset(scan, 0, sizeof(*scan));
+    
+    if (!(scan->ring = libreiserfs_calloc(JOURNAL_SCAN_RING * 
+	    dal_get_blocksize(journal->dal), 0)))
+	return 0;
+
+    scan->journal = journal;
+    scan->ahead = 1;
+    
+    return 1;
+}
+
+static void reiserfs_journal_scan_fini(struct reiserfs_journal_scan *scan) {
+    libreiserfs_free(scan->ring);
+}
+
+/* Returns data of the block at given journal offset */
+static char *reiserfs_journal_scan_block(struct reiserfs_journal_scan *scan, 
+    blk_t offset) 
+{
+    count_t count;
+    reiserfs_journal_t *journal = scan->journal;
+    size_t blocksize = dal_get_blocksize(journal->dal);
+    blk_t start = get_jp_start(&journal->head.jh_params);
+    blk_t len = get_jp_len(&journal->head.jh_params);
+    
+    if (offset < scan->lo || offset >= scan->hi + JOURNAL_SCAN_RING) {
+	scan->lo = scan->hi = offset;
+	scan->ahead = 1;
+    }
+
+    while (offset >= scan->hi) {
+	count = scan->ahead;
+	
+	if (count > JOURNAL_SCAN_RING - scan->hi % JOURNAL_SCAN_RING)
+	    count = JOURNAL_SCAN_RING - scan->hi % JOURNAL_SCAN_RING;
+	
+	if (count > len - scan->hi)
+	    count = len - scan->hi;
+	
+	if (!dal_read(journal->dal, scan->ring + (scan->hi % JOURNAL_SCAN_RING) * 
+	    blocksize, start + scan->hi, count))
+	{
+	    reiserfs_block_reading_failed(start + scan->hi, 
+		dal_error(journal->dal), return NULL);
+	}
+	
+	scan->hi += count;
+	
+	if (scan->hi - scan->lo > JOURNAL_SCAN_RING)
+	    scan->lo = scan->hi - JOURNAL_SCAN_RING;
+	
+	if (scan->ahead < JOURNAL_SCAN_RING / 4)
+	    scan->ahead <<= 1;
+    }
+
+    return scan->ring + (offset % JOURNAL_SCAN_RING) * blocksize;
+}
+
+/* 
+    Checking whether there is valid transaction at given offset. Transaction 
+    is valid if his description block is valid, commit block is valid and 
+    commit block matches description block. Returns 0 on read failure only, 
+    *desc is NULL when there is no transaction.
 	
     Transaction looks like this:
     desc_block + [ trans_blocks ] + comm_block
 */
-static int reiserfs_journal_desc_valid(reiserfs_journal_head_t *head, 
-    reiserfs_block_t *desc)
+static int reiserfs_journal_scan_trans(struct reiserfs_journal_scan *scan, 
+    blk_t offset, reiserfs_block_t **desc, reiserfs_block_t **comm)
 {
+    char *data;
     blk_t blk;
-    reiserfs_block_t *comm;
-	
-    if (!desc || !reiserfs_journal_desc_block(desc))
+    reiserfs_journal_t *journal = scan->journal;
+    blk_t start = get_jp_start(&journal->head.jh_params);
+    blk_t len = get_jp_len(&journal->head.jh_params);
+
+    *desc = *comm = NULL;
+    
+    if (!(data = reiserfs_journal_scan_block(scan, offset)))
 	return 0;
 
-    blk = reiserfs_journal_desc_comm(head, desc);
-    if (!(comm = reiserfs_block_read(desc->dal, blk)))
-	reiserfs_block_reading_failed(blk, dal_error(desc->dal), return 0);
-	
-    if (!reiserfs_journal_desc_match_comm(desc, comm))
-	goto error_free_comm;
+    if (!reiserfs_journal_desc_data(data, dal_get_blocksize(journal->dal)) || 
+	    LE32_TO_CPU(((reiserfs_journal_desc_t *)data)->jd_len) + 2 > len)
+	return 1;
 	
-    reiserfs_block_free(comm);
+    if (!(*desc = reiserfs_block_alloc_with_copy(journal->dal, start + offset, data)))
+	return 0;
+
+    blk = reiserfs_journal_desc_comm(&journal->head, *desc);
+    
+    if (!(data = reiserfs_journal_scan_block(scan, blk - start)))
+	goto error_free_desc;
+    
+    if (!(*comm = reiserfs_block_alloc_with_copy(journal->dal, blk, data)))
+	goto error_free_desc;
+    
+    if (!reiserfs_journal_desc_match_comm(*desc, *comm)) {
+	reiserfs_block_free(*comm);
+	reiserfs_block_free(*desc);
+	*desc = *comm = NULL;
+    }
+    
     return 1;
 	
-error_free_comm:
-    reiserfs_block_free(comm);
-error:
+error_free_desc:
+    reiserfs_block_free(*desc);
+    *desc = NULL;
     return 0;
 }
 
@@ -183,11 +279,10 @@ void reiserfs_journal_params_update(reiserfs_journal_params_t *params, blk_t sta
 int reiserfs_journal_pipe(reiserfs_journal_t *journal, blk_t from,
     reiserfs_journal_pipe_func_t pipe_func, void *data)
 {
-    blk_t start, len, curr;
+    blk_t len, curr;
     reiserfs_block_t *desc, *comm;
-    blk_t replay_start = get_jh_replay_offset(&journal->head);
+    struct reiserfs_journal_scan scan;
 	
-    start = get_jp_start(&journal->head.jh_params);
     len = get_jp_len(&journal->head.jh_params);
 
     if (from >= len) {
@@ -196,83 +291,775 @@ int reiserfs_journal_pipe(reiserfs_journal_t *journal, blk_t from,
 	return 0;
     }
 	
+    if (!reiserfs_journal_scan_init(&scan, journal))
+	return 0;
+    
     for (curr = from; curr < len; curr++) {
-	if (!(desc = reiserfs_block_read(journal->dal, start + curr)))
-	    reiserfs_block_reading_failed(start + curr, dal_error(journal->dal), return 0);
-	
-	if (!(comm = reiserfs_block_read(journal->dal, 
-	    reiserfs_journal_desc_comm(&journal->head, desc))))
-	{
-	    reiserfs_block_reading_failed(reiserfs_journal_desc_comm(&journal->head, desc), 
-		dal_error(journal->dal), goto error_free_desc);
-	}
+	if (!reiserfs_journal_scan_trans(&scan, curr, &desc, &comm))
+	    goto error_free_scan;
 	
-	if (!reiserfs_journal_desc_valid(&journal->head, desc))
-	    goto error_continue;
+	if (!desc)
+	    continue;
 
 	if (pipe_func && !pipe_func(journal, desc, comm, curr, data))
 	    goto error_free_comm;
 		
 	curr += get_jd_desc_trans_len(desc) + 1;
-error_continue:
+	
 	reiserfs_block_free(comm);
 	reiserfs_block_free(desc);
     }
+    
+    reiserfs_journal_scan_fini(&scan);
     return 1;
 	
 error_free_comm:
-    libreiserfs_free(comm);
-error_free_desc:
-    libreiserfs_free(desc);
-error:
+    reiserfs_block_free(comm);
+    reiserfs_block_free(desc);
+error_free_scan:
+    reiserfs_journal_scan_fini(&scan);
     return 0;
 }
 
-struct reiserfs_read_desc {
-    blk_t needle, found;
-};
+static uint32_t *reiserfs_journal_cashe_slot(reiserfs_journal_cashe_t *cashe, 
+    blk_t blk) 
+{
+    uint32_t i = (uint32_t)(blk * 0x9e3779b1) & (cashe->size - 1);
+
+    /* Linear probing, journal block is never zero for used slot */
+    while (cashe->blocks[i * 2 + 1] && cashe->blocks[i * 2] != blk)
+	i = (i + 1) & (cashe->size - 1);
+
+    return cashe->blocks + i * 2;
+}
 
-static int callback_journal_read(reiserfs_journal_t *journal, reiserfs_block_t *desc, 
-    reiserfs_block_t *comm, uint32_t number, struct reiserfs_read_desc *read_desc) 
+static int reiserfs_journal_cashe_insert(reiserfs_journal_cashe_t *cashe, 
+    blk_t blk, blk_t copy) 
 {
-    uint32_t i;
-    blk_t trans_half = journal_trans_half(dal_get_blocksize(journal->dal));
-    blk_t len = get_jp_len(&journal->head.jh_params) - 1;
-    blk_t start = get_jp_start(&journal->head.jh_params);
+    uint32_t *slot;
+	
+    if ((cashe->count + 1) * 2 > cashe->size) {
+	uint32_t i;
+	reiserfs_journal_cashe_t grown;
 
-    for (i = 0; i < get_jd_desc_trans_len(desc) && i < trans_half; i++)	{	
-	if (read_desc->needle == LE32_TO_CPU(get_desc_header(desc)->jd_realblock[i]))
-	    read_desc->found = (start + number + i + 1) & len;
-    }	
+	grown.size = (cashe->size ? cashe->size * 2 : 256);
+	grown.count = cashe->count;
+	grown.trans_nr = cashe->trans_nr;
 	
-    if (i >= trans_half) {
-	for (; i < get_jd_desc_trans_len(desc); i++) {
-	    uint32_t blk = LE32_TO_CPU(get_comm_header(comm)->jc_realblock[i - trans_half]);
-	    if (read_desc->needle == blk)
-	        read_desc->found = (start + number + i + 1) & len;
+	if (!(grown.blocks = libreiserfs_calloc(CASHE_SIZE(grown.size * 2), 0)))
+	    return 0;
+
+	for (i = 0; i < cashe->size; i++) {
+	    if (!cashe->blocks[i * 2 + 1])
+		continue;
+	    
+	    slot = reiserfs_journal_cashe_slot(&grown, cashe->blocks[i * 2]);
+	    slot[0] = cashe->blocks[i * 2];
+	    slot[1] = cashe->blocks[i * 2 + 1];
 	}
+
+	if (cashe->blocks)
+	    libreiserfs_free(cashe->blocks);
+	
+	*cashe = grown;
     }
 
+    slot = reiserfs_journal_cashe_slot(cashe, blk);
+    
+    if (!slot[1])
+	cashe->count++;
+    
+    slot[0] = blk;
+    slot[1] = copy;
+	
+    return 1;
+}
+
+/* 
+    Builds the index of logged blocks. Transactions newer than the last 
+    flushed one are followed from the first unflushed offset while their 
+    ids keep growing, so later copies of a block replace earlier ones.
+*/
+static int reiserfs_journal_cashe_build(reiserfs_journal_t *journal) {
+    uint32_t i, trans_id;
+    blk_t start, len, offset, walked;
+    reiserfs_block_t *desc, *comm;
+    struct reiserfs_journal_scan scan;
+    blk_t trans_half = journal_trans_half(dal_get_blocksize(journal->dal));
+	
+    start = get_jp_start(&journal->head.jh_params);
+    len = get_jp_len(&journal->head.jh_params);
+	
+    offset = get_jh_replay_offset(&journal->head);
+    trans_id = get_jh_last_flushed(&journal->head);
+	
+    if (!reiserfs_journal_scan_init(&scan, journal))
+	return 0;
+	
+    for (walked = 0; walked < len; ) {
+	if (!reiserfs_journal_scan_trans(&scan, offset, &desc, &comm))
+	    goto error_free_scan;
+	
+	if (!desc)
+	    break;
+
+	if (get_jd_desc_trans_id(desc) <= trans_id) {
+	    reiserfs_block_free(comm);
+	    reiserfs_block_free(desc);
+	    break;
+	}
+	
+	trans_id = get_jd_desc_trans_id(desc);
+	
+	for (i = 0; i < get_jd_desc_trans_len(desc); i++) {
+	    blk_t blk = (i < trans_half ? 
+		LE32_TO_CPU(get_desc_header(desc)->jd_realblock[i]) : 
+		LE32_TO_CPU(get_comm_header(comm)->jc_realblock[i - trans_half]));
+		
+	    if (!reiserfs_journal_cashe_insert(&journal->cashe, blk, 
+		    start + (offset + i + 1) % len))
+		goto error_free_comm;
+	}
+	
+	journal->cashe.trans_nr++;
+	walked += get_jd_desc_trans_len(desc) + 2;
+	offset = reiserfs_journal_desc_next(&journal->head, desc) - start;
+	
+	reiserfs_block_free(comm);
+	reiserfs_block_free(desc);
+    }
+    
+    journal->cashe.trans_id = trans_id;
+    journal->cashe.offset = offset;
+    
+    reiserfs_journal_scan_fini(&scan);
     return 1;
+	
+error_free_comm:
+    reiserfs_block_free(comm);
+    reiserfs_block_free(desc);
+error_free_scan:
+    reiserfs_journal_scan_fini(&scan);
+    return 0;
 }
 
+static blk_t reiserfs_journal_cashe_find(reiserfs_journal_t *journal, blk_t blk) {
+    if (!journal->cashe.count)
+	return 0;
+	
+    return reiserfs_journal_cashe_slot(&journal->cashe, blk)[1];
+}
+
+/* Returns the newest logged copy of given block, or NULL if block isn't logged */
 reiserfs_block_t *reiserfs_journal_read(reiserfs_journal_t *journal, blk_t blk) {
-    struct reiserfs_read_desc desc;
+    blk_t copy;
 	
     ASSERT(journal != NULL, return NULL);
 
-    memset(&desc, 0, sizeof(desc));
-    desc.needle = blk;
-	
-    if (!reiserfs_journal_pipe(journal, get_jh_replay_offset(&journal->head), 
-	    (reiserfs_journal_pipe_func_t)callback_journal_read, &desc))
+    if (!(copy = reiserfs_journal_cashe_find(journal, blk)))
 	return NULL;
 	
-    if (desc.found && desc.found > get_jp_start(&journal->head.jh_params) + 
-	    get_jp_len(&journal->head.jh_params) - 1)
+    return reiserfs_block_read(journal->dal, copy);
+}
+
+/* 
+    Journal overlay. It is read-only device over the host one, which reads 
+    logged blocks from the journal and others from their home locations. 
+    So a dirty filesystem may be looked at without replaying.
+*/
+struct reiserfs_journal_overlay {
+    dal_t *host;
+    reiserfs_journal_t *journal;
+    unsigned blocksize;
+};
+
+static int reiserfs_journal_overlay_read(dal_t *dal, void *buff, blk_t block, 
+    count_t count) 
+{
+    blk_t copy;
+    count_t i, run;
+    struct reiserfs_journal_overlay *overlay;
+	
+    overlay = (struct reiserfs_journal_overlay *)dal->entity;
+    
+    if (dal_get_blocksize(overlay->host) != dal->blocksize)
+	dal_set_blocksize(overlay->host, dal->blocksize);
+	
+    /* Journal knows blocks of filesystem's size only */
+    if (dal->blocksize != overlay->blocksize)
+	return dal_read(overlay->host, buff, block, count);
+	
+    for (i = 0; i < count; i += run) {
+	if ((copy = reiserfs_journal_cashe_find(overlay->journal, block + i))) {
+	    dal_set_blocksize(overlay->journal->dal, overlay->blocksize);
+	    
+	    if (!dal_read(overlay->journal->dal, (char *)buff + i * dal->blocksize, 
+		    copy, 1)) 
+	    {
+		strncpy(dal->error, dal_error(overlay->journal->dal), 
+		    sizeof(dal->error) - 1);
+		return 0;
+	    }
+	    
+	    run = 1;
+	    continue;
+	}
+	
+	for (run = 1; i + run < count && !reiserfs_journal_cashe_find(overlay->journal, 
+	    block + i + run); run++);
+	
+	if (!dal_read(overlay->host, (char *)buff + i * dal->blocksize, 
+		block + i, run)) 
+	{
+	    strncpy(dal->error, dal_error(overlay->host), sizeof(dal->error) - 1);
+	    return 0;
+	}
+    }
+    
+    return 1;
+}
+
+static int reiserfs_journal_overlay_write(dal_t *dal, void *buff, blk_t block, 
+    count_t count) 
+{
+    strncpy(dal->error, _("Journal overlay is read-only"), sizeof(dal->error) - 1);
+    return 0;
+}
+
+static int reiserfs_journal_overlay_sync(dal_t *dal) {
+    return 1;
+}
+
+static int reiserfs_journal_overlay_flags(dal_t *dal) {
+    return dal->flags;
+}
+
+static int reiserfs_journal_overlay_equals(dal_t *dal1, dal_t *dal2) {
+    return dal_equals(((struct reiserfs_journal_overlay *)dal1->entity)->host, dal2);
+}
+
+static unsigned int reiserfs_journal_overlay_stat(dal_t *dal) {
+    return dal_stat(((struct reiserfs_journal_overlay *)dal->entity)->host);
+}
+
+static count_t reiserfs_journal_overlay_len(dal_t *dal) {
+    struct reiserfs_journal_overlay *overlay;
+	
+    overlay = (struct reiserfs_journal_overlay *)dal->entity;
+    dal_set_blocksize(overlay->host, dal->blocksize);
+    
+    return dal_len(overlay->host);
+}
+
+static struct dal_ops overlay_ops = {
+    .read = reiserfs_journal_overlay_read,
+    .write = reiserfs_journal_overlay_write,
+    .sync = reiserfs_journal_overlay_sync,
+    .flags = reiserfs_journal_overlay_flags,
+    .equals = reiserfs_journal_overlay_equals,
+    .stat = reiserfs_journal_overlay_stat,
+    .len = reiserfs_journal_overlay_len
+};
+
+dal_t *reiserfs_journal_overlay_open(reiserfs_journal_t *journal, dal_t *host) {
+    dal_t *dal;
+    struct reiserfs_journal_overlay *overlay;
+	
+    ASSERT(journal != NULL, return NULL);
+    ASSERT(host != NULL, return NULL);
+	
+    if (!(overlay = libreiserfs_calloc(sizeof(*overlay), 0)))
 	return NULL;
+	
+    overlay->host = host;
+    overlay->journal = journal;
+    overlay->blocksize = dal_get_blocksize(journal->dal);
+	
+    if (!(dal = dal_open(&overlay_ops, dal_get_blocksize(host), O_RDONLY, host->data)))
+	goto error_free_overlay;
+	
+    memset(dal->name, 0, sizeof(dal->name));
+    memset(dal->error, 0, sizeof(dal->error));
+    strncpy(dal->name, dal_name(host), sizeof(dal->name) - 1);
+	
+    dal->entity = overlay;
+	
+    return dal;
+	
+error_free_overlay:
+    libreiserfs_free(overlay);
+    return NULL;
+}
+
+void reiserfs_journal_overlay_close(dal_t *dal) {
+    ASSERT(dal != NULL, return);
+	
+    libreiserfs_free(dal->entity);
+    dal_close(dal);
+}
 
-    return desc.found ? reiserfs_block_read(journal->dal, desc.found) : NULL;
+/* Drops the index, the journal header tells where the next transaction goes */
+static void reiserfs_journal_cashe_clear(reiserfs_journal_t *journal) {
+    if (journal->cashe.blocks)
+	libreiserfs_free(journal->cashe.blocks);
+	
+    memset(&journal->cashe, 0, sizeof(journal->cashe));
+	
+    journal->cashe.trans_id = get_jh_last_flushed(&journal->head);
+    journal->cashe.offset = get_jh_replay_offset(&journal->head);
+}
+
+struct reiserfs_replay_block {
+    blk_t home, copy;
+    blk_t order;
+    uint32_t slot;
+};
+
+static int reiserfs_journal_replay_home_cmp(const void *b1, const void *b2) {
+    blk_t home1 = ((struct reiserfs_replay_block *)b1)->home;
+    blk_t home2 = ((struct reiserfs_replay_block *)b2)->home;
+    
+    return home1 < home2 ? -1 : home1 > home2;
+}
+
+static int reiserfs_journal_replay_order_cmp(const void *b1, const void *b2) {
+    blk_t order1 = ((struct reiserfs_replay_block *)b1)->order;
+    blk_t order2 = ((struct reiserfs_replay_block *)b2)->order;
+    
+    return order1 < order2 ? -1 : order1 > order2;
+}
+
+/* Marks indexed transactions flushed in the journal header on disk */
+static int reiserfs_journal_head_flushed(reiserfs_journal_t *journal) {
+    blk_t blk;
+    reiserfs_block_t *block;
+    reiserfs_journal_head_t *head;
+
+    blk = get_jp_start(&journal->head.jh_params) + 
+	get_jp_len(&journal->head.jh_params);
+    
+    if (!(block = reiserfs_block_read(journal->dal, blk)))
+	reiserfs_block_reading_failed(blk, dal_error(journal->dal), return 0);
+
+    head = (reiserfs_journal_head_t *)block->data;
+    
+    set_jh_last_flushed(head, journal->cashe.trans_id);
+    set_jh_replay_offset(head, journal->cashe.offset);
+    
+    if (!reiserfs_block_write(journal->dal, block)) {
+	reiserfs_block_writing_failed(blk, dal_error(journal->dal), 
+	    goto error_free_block);
+    }
+    
+    reiserfs_block_free(block);
+    
+    set_jh_last_flushed(&journal->head, journal->cashe.trans_id);
+    set_jh_replay_offset(&journal->head, journal->cashe.offset);
+    
+    return dal_sync(journal->dal);
+	
+error_free_block:
+    reiserfs_block_free(block);
+    return 0;
+}
+
+/* 
+    Writes the newest copies of logged blocks to their places on given device 
+    and marks transactions flushed. Copies are read in journal order and 
+    written sorted by their home blocks, adjacent ones by one request.
+*/
+int reiserfs_journal_replay(reiserfs_journal_t *journal, dal_t *dal) {
+    char *data, *buff;
+    size_t blocksize;
+    blk_t start, len, first;
+    uint32_t i, count, run;
+    struct reiserfs_journal_scan scan;
+    struct reiserfs_replay_block *blocks;
+	
+    ASSERT(journal != NULL, return 0);
+    ASSERT(dal != NULL, return 0);
+	
+    if (!(count = journal->cashe.count))
+	return 1;
+	
+    blocksize = dal_get_blocksize(journal->dal);
+    start = get_jp_start(&journal->head.jh_params);
+    len = get_jp_len(&journal->head.jh_params);
+    first = get_jh_replay_offset(&journal->head);
+	
+    if (!(blocks = libreiserfs_calloc(count * sizeof(*blocks), 0)))
+	return 0;
+	
+    for (i = 0, run = 0; i < journal->cashe.size; i++) {
+	if (!journal->cashe.blocks[i * 2 + 1])
+	    continue;
+	
+	blocks[run].home = journal->cashe.blocks[i * 2];
+	blocks[run].copy = journal->cashe.blocks[i * 2 + 1];
+	blocks[run].order = (blocks[run].copy - start + len - first) % len;
+	run++;
+    }
+	
+    /* Every copy gets its place in the write buffer by home block */
+    qsort(blocks, count, sizeof(*blocks), reiserfs_journal_replay_home_cmp);
+	
+    for (i = 0; i < count; i++)
+	blocks[i].slot = i;
+	
+    if (!(buff = libreiserfs_calloc(count * blocksize, 0)))
+	goto error_free_blocks;
+	
+    if (!reiserfs_journal_scan_init(&scan, journal))
+	goto error_free_buff;
+	
+    qsort(blocks, count, sizeof(*blocks), reiserfs_journal_replay_order_cmp);
+	
+    for (i = 0; i < count; i++) {
+	if (!(data = reiserfs_journal_scan_block(&scan, blocks[i].copy - start)))
+	    goto error_free_scan;
+	
+	memcpy(buff + blocks[i].slot * blocksize, data, blocksize);
+    }
+	
+    reiserfs_journal_scan_fini(&scan);
+	
+    qsort(blocks, count, sizeof(*blocks), reiserfs_journal_replay_home_cmp);
+	
+    for (i = 0; i < count; i += run) {
+	for (run = 1; i + run < count && 
+	    blocks[i + run].home == blocks[i].home + run; run++);
+	
+	if (!dal_write(dal, buff + i * blocksize, blocks[i].home, run)) {
+	    reiserfs_block_writing_failed(blocks[i].home, dal_error(dal), 
+		goto error_free_buff);
+	}
+    }
+	
+    /* Transactions may be marked flushed only when their blocks are on disk */
+    if (!dal_sync(dal) || !reiserfs_journal_head_flushed(journal))
+	goto error_free_buff;
+	
+    reiserfs_journal_cashe_clear(journal);
+	
+    libreiserfs_free(buff);
+    libreiserfs_free(blocks);
+	
+    return 1;
+	
+error_free_scan:
+    reiserfs_journal_scan_fini(&scan);
+error_free_buff:
+    libreiserfs_free(buff);
+error_free_blocks:
+    libreiserfs_free(blocks);
+    return 0;
+}
+
+/* 
+    Transaction writer. Logical operations (begin, log, commit) are gathered 
+    into one batch, which goes to the journal as a single transaction when 
+    it reaches jp_max_batch blocks or is flushed. Descriptor and logged 
+    blocks are written first, then after ordering flush the commit block. 
+    Blocks are written to their places afterwards and the journal header 
+    is updated when journal space is needed again.
+*/
+static uint32_t reiserfs_journal_trans_max(reiserfs_journal_t *journal) {
+    uint32_t max_trans = get_jp_max_trans_len(&journal->head.jh_params);
+	
+    if (max_trans + 2 > get_jp_len(&journal->head.jh_params))
+	max_trans = get_jp_len(&journal->head.jh_params) - 2;
+	
+    return max_trans;
+}
+
+/* Batch is written when it is grown up to this after logical operation */
+static uint32_t reiserfs_journal_batch_max(reiserfs_journal_t *journal) {
+    uint32_t max_batch = get_jp_max_batch(&journal->head.jh_params);
+	
+    if (!max_batch || max_batch > reiserfs_journal_trans_max(journal))
+	max_batch = reiserfs_journal_trans_max(journal);
+	
+    return max_batch;
+}
+
+/* Marks all indexed transactions flushed, their blocks are in place already */
+static int reiserfs_journal_checkpoint(reiserfs_journal_t *journal) {
+    if (!journal->cashe.trans_nr)
+	return 1;
+	
+    if (!dal_sync(journal->batch.host) || !reiserfs_journal_head_flushed(journal))
+	return 0;
+
+    reiserfs_journal_cashe_clear(journal);
+    return 1;
+}
+
+static int reiserfs_journal_block_cmp(const void *b1, const void *b2) {
+    blk_t blk1 = reiserfs_block_get_nr(*(reiserfs_block_t **)b1);
+    blk_t blk2 = reiserfs_block_get_nr(*(reiserfs_block_t **)b2);
+    
+    return blk1 < blk2 ? -1 : blk1 > blk2;
+}
+
+/* Writes first count blocks of the batch as one transaction */
+static int reiserfs_journal_trans_write(reiserfs_journal_t *journal, uint32_t count) {
+    char *buff, *comm;
+    size_t blocksize;
+    uint32_t i, run, trans_id;
+    blk_t start, len, offset, used, blk;
+    reiserfs_block_t **blocks = (reiserfs_block_t **)journal->batch.blocks;
+	
+    blocksize = dal_get_blocksize(journal->dal);
+    start = get_jp_start(&journal->head.jh_params);
+    len = get_jp_len(&journal->head.jh_params);
+	
+    /* Making room, transactions before are on their places already */
+    used = (journal->cashe.offset + len - get_jh_replay_offset(&journal->head)) % len;
+	
+    if ((journal->cashe.trans_nr && !used) || used + count + 2 >= len) {
+	if (!reiserfs_journal_checkpoint(journal))
+	    return 0;
+    }
+	
+    offset = journal->cashe.offset;
+    trans_id = journal->cashe.trans_id + 1;
+	
+    if (!(buff = libreiserfs_calloc((count + 2) * blocksize, 0)))
+	return 0;
+	
+    comm = buff + (count + 1) * blocksize;
+	
+    ((reiserfs_journal_desc_t *)buff)->jd_trans_id = CPU_TO_LE32(trans_id);
+    ((reiserfs_journal_desc_t *)buff)->jd_len = CPU_TO_LE32(count);
+    ((reiserfs_journal_desc_t *)buff)->jd_mount_id = 
+	CPU_TO_LE32(get_jh_mount_id(&journal->head));
+    memcpy(buff + blocksize - 12, JOURNAL_DESC_SIGN, 8);
+	
+    ((reiserfs_journal_commit_t *)comm)->jc_trans_id = CPU_TO_LE32(trans_id);
+    ((reiserfs_journal_commit_t *)comm)->jc_len = CPU_TO_LE32(count);
+	
+    for (i = 0; i < count; i++) {
+	blk = reiserfs_block_get_nr(blocks[i]);
+	
+	if (i < journal_trans_half(blocksize))
+	    ((reiserfs_journal_desc_t *)buff)->jd_realblock[i] = CPU_TO_LE32(blk);
+	else {
+	    ((reiserfs_journal_commit_t *)comm)->jc_realblock[i - 
+		journal_trans_half(blocksize)] = CPU_TO_LE32(blk);
+	}
+	
+	memcpy(buff + (i + 1) * blocksize, blocks[i]->data, blocksize);
+    }
+	
+    /* Descriptor and logged blocks, possibly wrapped around journal end */
+    run = (count + 1 < len - offset ? count + 1 : len - offset);
+	
+    if (!dal_write(journal->dal, buff, start + offset, run))
+	goto error_write_failed;
+	
+    if (run < count + 1 && !dal_write(journal->dal, buff + run * blocksize, 
+	    start, count + 1 - run))
+	goto error_write_failed;
+	
+    blk = start + (offset + count + 1) % len;
+	
+    if (!dal_sync(journal->dal) || !dal_write(journal->dal, comm, blk, 1) || 
+	    !dal_sync(journal->dal))
+	goto error_write_failed;
+
+    for (i = 0; i < count; i++) {
+	if (!reiserfs_journal_cashe_insert(&journal->cashe, 
+		reiserfs_block_get_nr(blocks[i]), start + (offset + i + 1) % len))
+	    goto error_free_buff;
+    }
+	
+    journal->cashe.trans_nr++;
+    journal->cashe.trans_id = trans_id;
+    journal->cashe.offset = (offset + count + 2) % len;
+	
+    /* Committed blocks go to their places sorted, adjacent ones together */
+    qsort(blocks, count, sizeof(*blocks), reiserfs_journal_block_cmp);
+	
+    for (i = 0; i < count; i += run) {
+	for (run = 0; i + run < count && reiserfs_block_get_nr(blocks[i + run]) == 
+	    reiserfs_block_get_nr(blocks[i]) + run; run++)
+	{
+	    memcpy(buff + run * blocksize, blocks[i + run]->data, blocksize);
+	}
+	
+	if (!dal_write(journal->batch.host, buff, reiserfs_block_get_nr(blocks[i]), run)) {
+	    reiserfs_block_writing_failed(reiserfs_block_get_nr(blocks[i]), 
+		dal_error(journal->batch.host), goto error_free_buff);
+	}
+    }
+	
+    libreiserfs_free(buff);
+    return 1;
+	
+error_write_failed:
+    reiserfs_block_writing_failed(start + offset, dal_error(journal->dal), 
+	goto error_free_buff);
+error_free_buff:
+    libreiserfs_free(buff);
+    return 0;
+}
+
+/* Writes out the batch but blocks of the logical operation being in progress */
+static int reiserfs_journal_batch_write(reiserfs_journal_t *journal, uint32_t count) {
+    uint32_t i;
+    reiserfs_journal_batch_t *batch = &journal->batch;
+	
+    if (!count)
+	return 1;
+	
+    if (!reiserfs_journal_trans_write(journal, count))
+	return 0;
+	
+    for (i = 0; i < count; i++)
+	reiserfs_block_free(batch->blocks[i]);
+	
+    memmove(batch->blocks, batch->blocks + count, 
+	(batch->count - count) * sizeof(*batch->blocks));
+	
+    batch->count -= count;
+    batch->start = (batch->start > count ? batch->start - count : 0);
+	
+    return 1;
+}
+
+/* Starts logical operation over blocks of given host device */
+int reiserfs_journal_begin(reiserfs_journal_t *journal, dal_t *host) {
+    reiserfs_journal_batch_t *batch;
+	
+    ASSERT(journal != NULL, return 0);
+    ASSERT(host != NULL, return 0);
+
+    batch = &journal->batch;
+	
+    if (batch->host && batch->host != host) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Journal is used by another device."));
+	return 0;
+    }
+	
+    if (!batch->host) {
+	if (!(dal_flags(host) & O_RDWR) || !(dal_flags(journal->dal) & O_RDWR)) {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		_("Journal and device should be opened for write."));
+	    return 0;
+	}
+	
+	/* Found at open transactions should be in place before new ones */
+	if (!reiserfs_journal_replay(journal, host))
+	    return 0;
+
+	if (!(batch->blocks = libreiserfs_calloc(reiserfs_journal_trans_max(journal) * 
+		sizeof(*batch->blocks), 0)))
+	    return 0;
+	
+	batch->host = host;
+    }
+	
+    if (!batch->refs++)
+	batch->start = batch->count;
+	
+    return 1;
+}
+
+int reiserfs_journal_log(reiserfs_journal_t *journal, reiserfs_block_t *block) {
+    uint32_t i;
+    reiserfs_journal_batch_t *batch;
+	
+    ASSERT(journal != NULL, return 0);
+    ASSERT(block != NULL, return 0);
+
+    batch = &journal->batch;
+	
+    if (!batch->refs) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("There is no transaction begun."));
+	return 0;
+    }
+	
+    if (dal_get_blocksize(block->dal) != dal_get_blocksize(journal->dal)) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Block %lu has invalid size for logging."), reiserfs_block_get_nr(block));
+	return 0;
+    }
+	
+    /* The same block logged again by operation in progress replaces its copy */
+    for (i = batch->start; i < batch->count; i++) {
+	reiserfs_block_t *logged = (reiserfs_block_t *)batch->blocks[i];
+	
+	if (reiserfs_block_get_nr(logged) == reiserfs_block_get_nr(block)) {
+	    memcpy(logged->data, block->data, dal_get_blocksize(block->dal));
+	    return 1;
+	}
+    }
+	
+    /* Copy owned by committed operations is kept, they are written out first */
+    for (i = 0; i < batch->start; i++) {
+	if (reiserfs_block_get_nr((reiserfs_block_t *)batch->blocks[i]) == 
+		reiserfs_block_get_nr(block))
+	{
+	    if (!reiserfs_journal_batch_write(journal, batch->start))
+		return 0;
+	    break;
+	}
+    }
+	
+    /* Full batch gets written without the operation being in progress */
+    if (batch->count >= reiserfs_journal_trans_max(journal)) {
+	if (!batch->start) {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		_("Transaction is too big for the journal."));
+	    return 0;
+	}
+	
+	if (!reiserfs_journal_batch_write(journal, batch->start))
+	    return 0;
+    }
+	
+    if (!(batch->blocks[batch->count] = reiserfs_block_alloc_with_copy(journal->dal, 
+	    reiserfs_block_get_nr(block), block->data)))
+	return 0;
+	
+    batch->count++;
+	
+    return 1;
+}
+
+/* Ends logical operation. It reaches the disk with its batch */
+int reiserfs_journal_commit(reiserfs_journal_t *journal) {
+    reiserfs_journal_batch_t *batch;
+	
+    ASSERT(journal != NULL, return 0);
+
+    batch = &journal->batch;
+	
+    if (!batch->refs) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("There is no transaction begun."));
+	return 0;
+    }
+	
+    if (--batch->refs)
+	return 1;
+	
+    batch->start = batch->count;
+	
+    if (batch->count >= reiserfs_journal_batch_max(journal))
+	return reiserfs_journal_batch_write(journal, batch->count);
+	
+    return 1;
+}
+
+/* Writes committed logical operations to the journal and to their places */
+int reiserfs_journal_flush(reiserfs_journal_t *journal) {
+    ASSERT(journal != NULL, return 0);
+	
+    return reiserfs_journal_batch_write(journal, journal->batch.refs ? 
+	journal->batch.start : journal->batch.count);
 }
 
 reiserfs_journal_t *reiserfs_journal_open(dal_t *dal, blk_t start, blk_t len, int relocated) {
@@ -321,6 +1108,13 @@ reiserfs_journal_t *reiserfs_journal_open(dal_t *dal, blk_t start, blk_t len, in
 
     journal->dal = dal;
 	
+    if (!reiserfs_journal_cashe_build(journal)) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+	    _("Couldn't index journal transactions."));
+	reiserfs_journal_close(journal);
+	goto error;
+    }
+	
     return journal;
 
 error_free_journal:
@@ -399,11 +1193,25 @@ error:
 }
 
 void reiserfs_journal_close(reiserfs_journal_t *journal) {
+    uint32_t i;
+	
     ASSERT(journal != NULL, return);
 	
     if (journal->cashe.blocks) 
 	libreiserfs_free(journal->cashe.blocks);
 
+    if (journal->batch.count) {
+	libreiserfs_exception_throw(EXCEPTION_WARNING, EXCEPTION_IGNORE, 
+	    _("Journal is closed with %u blocks not flushed."), 
+	    journal->batch.count);
+    }
+	
+    for (i = 0; i < journal->batch.count; i++)
+	reiserfs_block_free(journal->batch.blocks[i]);
+	
+    if (journal->batch.blocks)
+	libreiserfs_free(journal->batch.blocks);
+
     libreiserfs_free(journal);
 }
 
@@ -461,11 +1269,6 @@ static int callback_journal_replay(reiserfs_journal_t *journal, reiserfs_block_t
 	     get_jp_len(&journal->head.jh_params)) + 1);
     }	
 
-    if (!reiserfs_journal_desc_valid(&journal->head, desc)) {
-	reiserfs_block_free(desc);
-	return 1;
-    }
-
     replay_desc->trans++;
 
     if (get_jd_desc_trans_id(desc) < replay_desc->oldest_id) {
@@ -487,8 +1290,8 @@ blk_t reiserfs_journal_boundary_transactions(reiserfs_journal_t *journal,
     reiserfs_gauge_t *gauge=NULL;
     struct reiserfs_replay_desc desc;
 
-    (void)oldest;
-    (void)newest;
+    desc.oldest_tr = oldest;
+    desc.newest_tr = newest;
 	
     desc.oldest_id = 0xffffffff; desc.newest_id = 0x0;
 	
@@ -4,45 +4,6 @@
     licensing and copyright details.
 */
 
-/*
-    Ext2/linux mode flags. We define them here so that we don't need to depend on 
-    the OS's sys/stat.h, since we may be compiling on a non-Linux system.
-*/
-#define LINUX_S_IFMT	    00170000
-#define LINUX_S_IFSOCK	    0140000
-#define LINUX_S_IFLNK	    0120000
-#define LINUX_S_IFREG	    0100000
-#define LINUX_S_IFBLK	    0060000
-#define LINUX_S_IFDIR	    0040000
-#define LINUX_S_IFCHR	    0020000
-#define LINUX_S_IFIFO	    0010000
-#define LINUX_S_ISUID	    0004000
-#define LINUX_S_ISGID	    0002000
-#define LINUX_S_ISVTX	    0001000
-
-#define LINUX_S_IRWXU	    00700
-#define LINUX_S_IRUSR	    00400
-#define LINUX_S_IWUSR	    00200
-#define LINUX_S_IXUSR	    00100
-
-#define LINUX_S_IRWXG	    00070
-#define LINUX_S_IRGRP	    00040
-#define LINUX_S_IWGRP	    00020
-#define LINUX_S_IXGRP	    00010
-
-#define LINUX_S_IRWXO	    00007
-#define LINUX_S_IROTH	    00004
-#define LINUX_S_IWOTH	    00002
-#define LINUX_S_IXOTH	    00001
-
-#define LINUX_S_ISLNK(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFLNK)
-#define LINUX_S_ISREG(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFREG)
-#define LINUX_S_ISDIR(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFDIR)
-#define LINUX_S_ISCHR(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFCHR)
-#define LINUX_S_ISBLK(m)    (((m) & LINUX_S_IFMT) == LINUX_S_IFBLK)
-#define LINUX_S_ISFIFO(m)   (((m) & LINUX_S_IFMT) == LINUX_S_IFIFO)
-#define LINUX_S_ISSOCK(m)   (((m) & LINUX_S_IFMT) == LINUX_S_IFSOCK)
-
 #ifdef HAVE_CONFIG_H
 #  include <config.h>
 #endif
@@ -50,6 +11,10 @@
 #include <string.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
+
 #if defined(__sparc__) || defined(__sparcv9)
 #  include <reiserfs/strsep.h>
 #endif
@@ -166,45 +131,230 @@ mark_super:
     return 1;	    
 }
 
-static void object_fill_stat(reiserfs_object_t *object, int format, void *sd) {
+/* Decodes stat data item into struct stat */
+void reiserfs_object_fill_stat(reiserfs_fs_t *fs, reiserfs_item_head_t *item, 
+    void *sd, struct stat *stat) 
+{
     uint32_t dev;
     reiserfs_sd_v1_t *sd_v1;
     reiserfs_sd_v2_t *sd_v2;
 
-    memset(&object->stat, 0, sizeof(object->stat));
+    memset(stat, 0, sizeof(*stat));
 	
-    object->stat.st_ino = get_key_objid(&object->key);
-    object->stat.st_blksize = reiserfs_fs_block_size(object->fs);
+    stat->st_ino = get_key_objid(&item->ih_key);
+    stat->st_blksize = reiserfs_fs_block_size(fs);
 	
-    if (format == ITEM_FORMAT_1) {
+    if (get_ih_item_format(item) == ITEM_FORMAT_1) {
 	sd_v1 = (reiserfs_sd_v1_t *)sd;
 
-	object->stat.st_mode = get_sd_v1_mode(sd_v1);
-	object->stat.st_nlink = get_sd_v1_nlink(sd_v1);
-	object->stat.st_uid = get_sd_v1_uid(sd_v1);
-	object->stat.st_gid = get_sd_v1_gid(sd_v1);
-	object->stat.st_rdev = get_sd_v1_rdev(sd_v1);
-	object->stat.st_size = get_sd_v1_size(sd_v1);
+	stat->st_mode = get_sd_v1_mode(sd_v1);
+	stat->st_nlink = get_sd_v1_nlink(sd_v1);
+	stat->st_uid = get_sd_v1_uid(sd_v1);
+	stat->st_gid = get_sd_v1_gid(sd_v1);
+	stat->st_rdev = get_sd_v1_rdev(sd_v1);
+	stat->st_size = get_sd_v1_size(sd_v1);
 	
 #ifndef DJGPP
-	object->stat.st_blocks = get_sd_v1_blocks(sd_v1);
+	stat->st_blocks = get_sd_v1_blocks(sd_v1);
 #endif
-	object->stat.st_atime = get_sd_v1_atime(sd_v1);
-	object->stat.st_mtime = get_sd_v1_mtime(sd_v1);
-	object->stat.st_ctime = get_sd_v1_ctime(sd_v1);
+	stat->st_atime = get_sd_v1_atime(sd_v1);
+	stat->st_mtime = get_sd_v1_mtime(sd_v1);
+	stat->st_ctime = get_sd_v1_ctime(sd_v1);
     } else {
 	sd_v2 = (reiserfs_sd_v2_t *)sd;
 		
-	object->stat.st_mode = get_sd_v2_mode(sd_v2);
-	object->stat.st_nlink = get_sd_v2_nlink(sd_v2);
-	object->stat.st_uid = get_sd_v2_uid(sd_v2);
-	object->stat.st_gid = get_sd_v2_gid(sd_v2);
-	object->stat.st_rdev = get_sd_v2_rdev(sd_v2);
-	object->stat.st_size = get_sd_v2_size(sd_v2);
-	object->stat.st_atime = get_sd_v2_atime(sd_v2);
-	object->stat.st_mtime = get_sd_v2_mtime(sd_v2);
-	object->stat.st_ctime = get_sd_v2_ctime(sd_v2);
+	stat->st_mode = get_sd_v2_mode(sd_v2);
+	stat->st_nlink = get_sd_v2_nlink(sd_v2);
+	stat->st_uid = get_sd_v2_uid(sd_v2);
+	stat->st_gid = get_sd_v2_gid(sd_v2);
+	stat->st_rdev = get_sd_v2_rdev(sd_v2);
+	stat->st_size = get_sd_v2_size(sd_v2);
+	stat->st_atime = get_sd_v2_atime(sd_v2);
+	stat->st_mtime = get_sd_v2_mtime(sd_v2);
+	stat->st_ctime = get_sd_v2_ctime(sd_v2);
+    }
+}
+
+/* 
+    Stat data cache. Maps object key to the decoded stat data and the place 
+    of the stat item in the tree. Its memory is bounded by OBJECT_SCACHE_LIMIT, 
+    least recently used entries are dropped first.
+*/
+struct reiserfs_sentry {
+    struct reiserfs_sentry *next;
+    struct reiserfs_sentry *older, *newer;
+	
+    uint32_t dirid, objid;
+    blk_t blk;
+    uint32_t pos;
+	
+    struct stat stat;
+};
+
+struct reiserfs_scache {
+    struct reiserfs_sentry *table[OBJECT_SCACHE_SIZE];
+    struct reiserfs_sentry *oldest, *newest;
+    uint32_t size;
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t reiserfs_object_scache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define reiserfs_object_scache_lock() \
+	pthread_mutex_lock(&reiserfs_object_scache_mutex)
+#  define reiserfs_object_scache_unlock() \
+	pthread_mutex_unlock(&reiserfs_object_scache_mutex)
+#else
+#  define reiserfs_object_scache_lock()
+#  define reiserfs_object_scache_unlock()
+#endif
+
+#define reiserfs_object_scache_bucket(dirid, objid) \
+	(((objid) * 0x9e3779b1 ^ (dirid)) & (OBJECT_SCACHE_SIZE - 1))
+
+static void reiserfs_object_scache_unlink(struct reiserfs_scache *scache, 
+    struct reiserfs_sentry *sentry)
+{
+    struct reiserfs_sentry **chain;
+	
+    for (chain = &scache->table[reiserfs_object_scache_bucket(sentry->dirid, 
+	    sentry->objid)]; *chain != sentry; chain = &(*chain)->next);
+	
+    *chain = sentry->next;
+	
+    if (sentry->older)
+	sentry->older->newer = sentry->newer;
+    else
+	scache->oldest = sentry->newer;
+	
+    if (sentry->newer)
+	sentry->newer->older = sentry->older;
+    else
+	scache->newest = sentry->older;
+	
+    scache->size -= sizeof(*sentry);
+}
+
+static void reiserfs_object_scache_link(struct reiserfs_scache *scache, 
+    struct reiserfs_sentry *sentry)
+{
+    struct reiserfs_sentry **chain;
+	
+    chain = &scache->table[reiserfs_object_scache_bucket(sentry->dirid, 
+	sentry->objid)];
+	
+    sentry->next = *chain;
+    *chain = sentry;
+	
+    sentry->newer = NULL;
+    sentry->older = scache->newest;
+	
+    if (scache->newest)
+	scache->newest->newer = sentry;
+    else
+	scache->oldest = sentry;
+	
+    scache->newest = sentry;
+    scache->size += sizeof(*sentry);
+}
+
+static struct reiserfs_sentry *reiserfs_object_scache_lookup(
+    struct reiserfs_scache *scache, struct key *key)
+{
+    struct reiserfs_sentry *sentry;
+	
+    for (sentry = scache->table[reiserfs_object_scache_bucket(get_key_dirid(key), 
+	get_key_objid(key))]; sentry; sentry = sentry->next)
+    {
+	if (sentry->objid == get_key_objid(key) && 
+		sentry->dirid == get_key_dirid(key))
+	    return sentry;
+    }
+	
+    return NULL;
+}
+
+static int reiserfs_object_scache_find(reiserfs_fs_t *fs, struct key *key, 
+    struct stat *stat)
+{
+    struct reiserfs_sentry *sentry = NULL;
+	
+    reiserfs_object_scache_lock();
+	
+    if (fs->scache && (sentry = reiserfs_object_scache_lookup(fs->scache, key))) {
+	memcpy(stat, &sentry->stat, sizeof(*stat));
+	
+	/* Making it the most recently used */
+	reiserfs_object_scache_unlink(fs->scache, sentry);
+	reiserfs_object_scache_link(fs->scache, sentry);
     }
+	
+    reiserfs_object_scache_unlock();
+	
+    return sentry != NULL;
+}
+
+static void reiserfs_object_scache_insert(reiserfs_fs_t *fs, struct key *key, 
+    reiserfs_path_node_t *leaf, struct stat *stat)
+{
+    struct reiserfs_sentry *sentry;
+	
+    reiserfs_object_scache_lock();
+	
+    if (!fs->scache && !(fs->scache = libreiserfs_calloc(sizeof(*fs->scache), 0)))
+	goto error_unlock;
+	
+    if ((sentry = reiserfs_object_scache_lookup(fs->scache, key)))
+	reiserfs_object_scache_unlink(fs->scache, sentry);
+    else if (fs->scache->size + sizeof(*sentry) > OBJECT_SCACHE_LIMIT) {
+	sentry = fs->scache->oldest;
+	reiserfs_object_scache_unlink(fs->scache, sentry);
+    } else if (!(sentry = libreiserfs_calloc(sizeof(*sentry), 0)))
+	goto error_unlock;
+	
+    sentry->dirid = get_key_dirid(key);
+    sentry->objid = get_key_objid(key);
+    sentry->blk = reiserfs_block_get_nr(leaf->node);
+    sentry->pos = leaf->pos;
+    memcpy(&sentry->stat, stat, sizeof(*stat));
+	
+    reiserfs_object_scache_link(fs->scache, sentry);
+	
+error_unlock:
+    reiserfs_object_scache_unlock();
+}
+
+/* 
+    Drops cached stat data kept in the given leaf or all of it if blk is zero.
+    Should be called by anything writing tree nodes.
+*/
+void reiserfs_object_scache_invalidate(reiserfs_fs_t *fs, blk_t blk) {
+    uint32_t i;
+    struct reiserfs_sentry *sentry, *next;
+	
+    ASSERT(fs != NULL, return);
+	
+    reiserfs_object_scache_lock();
+	
+    if (fs->scache) {
+	for (i = 0; i < OBJECT_SCACHE_SIZE; i++) {
+	    for (sentry = fs->scache->table[i]; sentry; sentry = next) {
+		next = sentry->next;
+		
+		if (blk && sentry->blk != blk)
+		    continue;
+		
+		reiserfs_object_scache_unlink(fs->scache, sentry);
+		libreiserfs_free(sentry);
+	    }
+	}
+	
+	if (!blk) {
+	    libreiserfs_free(fs->scache);
+	    fs->scache = NULL;
+	}
+    }
+	
+    reiserfs_object_scache_unlock();
 }
 
 int reiserfs_object_find_stat(reiserfs_object_t *object) {
@@ -212,6 +362,9 @@ int reiserfs_object_find_stat(reiserfs_object_t *object) {
     reiserfs_path_node_t *leaf;
     reiserfs_item_head_t *item;
 	
+    if (reiserfs_object_scache_find(object->fs, &object->key, &object->stat))
+	return 1;
+	
     if (!(leaf = reiserfs_object_seek_by_offset(object, SD_OFFSET, 
 	KEY_TYPE_SD, reiserfs_key_comp_four_components)))
     {	
@@ -224,7 +377,8 @@ int reiserfs_object_find_stat(reiserfs_object_t *object) {
     item = get_ih_item_head(leaf->node, leaf->pos);
     sd = get_ih_item_body(leaf->node, item);
 
-    object_fill_stat(object, get_ih_item_format(item), sd);
+    reiserfs_object_fill_stat(object->fs, item, sd, &object->stat);
+    reiserfs_object_scache_insert(object->fs, &object->key, leaf, &object->stat);
 	
     return 1;
 }
@@ -275,14 +429,229 @@ int reiserfs_object_find_entry(reiserfs_path_node_t *leaf, uint32_t hash,
     return 0;
 }
 
+/* 
+    Dentry cache. Maps parent dir key and name to the key and the mode of the 
+    entry, so common prefixes aren't resolved again. Negative entries have 
+    zero objectid. Least recently used entries are dropped when the cache is 
+    full. Caches of all filesystems are guarded by one lock.
+*/
+struct reiserfs_dentry {
+    struct reiserfs_dentry *next;
+    struct reiserfs_dentry *older, *newer;
+	
+    uint32_t hash;
+    uint32_t parent_dirid, parent_objid;
+    uint32_t dirid, objid;
+    uint16_t mode;
+	
+    char name[];
+};
+
+struct reiserfs_dcache {
+    struct reiserfs_dentry *table[OBJECT_DCACHE_SIZE];
+    struct reiserfs_dentry *oldest, *newest;
+    uint32_t count;
+};
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t reiserfs_object_dcache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define reiserfs_object_dcache_lock() \
+	pthread_mutex_lock(&reiserfs_object_dcache_mutex)
+#  define reiserfs_object_dcache_unlock() \
+	pthread_mutex_unlock(&reiserfs_object_dcache_mutex)
+#else
+#  define reiserfs_object_dcache_lock()
+#  define reiserfs_object_dcache_unlock()
+#endif
+
+static uint32_t reiserfs_object_dcache_hash(struct key *dirkey, const char *name) {
+    uint32_t hash = get_key_objid(dirkey) * 0x9e3779b1;
+	
+    while (*name)
+	hash = (hash ^ (unsigned char)*name++) * 0x01000193;
+	
+    return hash;
+}
+
+static void reiserfs_object_dcache_unlink(struct reiserfs_dcache *dcache, 
+    struct reiserfs_dentry *dentry)
+{
+    struct reiserfs_dentry **chain;
+	
+    for (chain = &dcache->table[dentry->hash & (OBJECT_DCACHE_SIZE - 1)]; 
+	    *chain != dentry; chain = &(*chain)->next);
+	
+    *chain = dentry->next;
+	
+    if (dentry->older)
+	dentry->older->newer = dentry->newer;
+    else
+	dcache->oldest = dentry->newer;
+	
+    if (dentry->newer)
+	dentry->newer->older = dentry->older;
+    else
+	dcache->newest = dentry->older;
+	
+    dcache->count--;
+}
+
+static void reiserfs_object_dcache_link(struct reiserfs_dcache *dcache, 
+    struct reiserfs_dentry *dentry)
+{
+    struct reiserfs_dentry **chain;
+	
+    chain = &dcache->table[dentry->hash & (OBJECT_DCACHE_SIZE - 1)];
+	
+    dentry->next = *chain;
+    *chain = dentry;
+	
+    dentry->newer = NULL;
+    dentry->older = dcache->newest;
+	
+    if (dcache->newest)
+	dcache->newest->newer = dentry;
+    else
+	dcache->oldest = dentry;
+	
+    dcache->newest = dentry;
+    dcache->count++;
+}
+
+static struct reiserfs_dentry *reiserfs_object_dcache_lookup(
+    struct reiserfs_dcache *dcache, struct key *dirkey, const char *name, 
+    uint32_t hash)
+{
+    struct reiserfs_dentry *dentry;
+	
+    for (dentry = dcache->table[hash & (OBJECT_DCACHE_SIZE - 1)]; dentry; 
+	dentry = dentry->next)
+    {
+	if (dentry->hash == hash && dentry->parent_objid == get_key_objid(dirkey) && 
+		dentry->parent_dirid == get_key_dirid(dirkey) && 
+		!strcmp(dentry->name, name))
+	    return dentry;
+    }
+	
+    return NULL;
+}
+
+/* 
+    Looks name up in the dentry cache. Fills entry key and mode on hit, 
+    objectid of the key is zero for a known missing entry.
+*/
+static int reiserfs_object_dcache_find(reiserfs_fs_t *fs, struct key *dirkey, 
+    const char *name, struct key *key, uint16_t *mode)
+{
+    uint32_t hash;
+    struct reiserfs_dentry *dentry = NULL;
+	
+    hash = reiserfs_object_dcache_hash(dirkey, name);
+	
+    reiserfs_object_dcache_lock();
+	
+    if (fs->dcache && (dentry = reiserfs_object_dcache_lookup(fs->dcache, 
+	dirkey, name, hash)))
+    {
+	set_key_dirid(key, dentry->dirid);
+	set_key_objid(key, dentry->objid);
+	*mode = dentry->mode;
+	
+	/* Making it the most recently used */
+	reiserfs_object_dcache_unlink(fs->dcache, dentry);
+	reiserfs_object_dcache_link(fs->dcache, dentry);
+    }
+	
+    reiserfs_object_dcache_unlock();
+	
+    return dentry != NULL;
+}
+
+static void reiserfs_object_dcache_insert(reiserfs_fs_t *fs, struct key *dirkey, 
+    const char *name, struct key *key, uint16_t mode)
+{
+    uint32_t hash;
+    struct reiserfs_dentry *dentry;
+	
+    hash = reiserfs_object_dcache_hash(dirkey, name);
+	
+    reiserfs_object_dcache_lock();
+	
+    if (!fs->dcache && !(fs->dcache = libreiserfs_calloc(sizeof(*fs->dcache), 0)))
+	goto error_unlock;
+	
+    if ((dentry = reiserfs_object_dcache_lookup(fs->dcache, dirkey, name, hash))) {
+	reiserfs_object_dcache_unlink(fs->dcache, dentry);
+	libreiserfs_free(dentry);
+    }
+	
+    if (fs->dcache->count >= OBJECT_DCACHE_MAX) {
+	dentry = fs->dcache->oldest;
+	reiserfs_object_dcache_unlink(fs->dcache, dentry);
+	libreiserfs_free(dentry);
+    }
+	
+    if (!(dentry = libreiserfs_calloc(sizeof(*dentry) + strlen(name) + 1, 0)))
+	goto error_unlock;
+	
+    dentry->hash = hash;
+    dentry->parent_dirid = get_key_dirid(dirkey);
+    dentry->parent_objid = get_key_objid(dirkey);
+    dentry->dirid = get_key_dirid(key);
+    dentry->objid = get_key_objid(key);
+    dentry->mode = mode;
+    strcpy(dentry->name, name);
+	
+    reiserfs_object_dcache_link(fs->dcache, dentry);
+	
+error_unlock:
+    reiserfs_object_dcache_unlock();
+}
+
+/* 
+    Drops cached entries of the given dir or all of them if dirkey is NULL. 
+    Should be called by anything changing directories.
+*/
+void reiserfs_object_dcache_invalidate(reiserfs_fs_t *fs, struct key *dirkey) {
+    uint32_t i;
+    struct reiserfs_dentry *dentry, *next;
+	
+    ASSERT(fs != NULL, return);
+	
+    reiserfs_object_dcache_lock();
+	
+    if (fs->dcache) {
+	for (i = 0; i < OBJECT_DCACHE_SIZE; i++) {
+	    for (dentry = fs->dcache->table[i]; dentry; dentry = next) {
+		next = dentry->next;
+		
+		if (dirkey && (dentry->parent_dirid != get_key_dirid(dirkey) || 
+			dentry->parent_objid != get_key_objid(dirkey)))
+		    continue;
+		
+		reiserfs_object_dcache_unlink(fs->dcache, dentry);
+		libreiserfs_free(dentry);
+	    }
+	}
+	
+	if (!dirkey) {
+	    libreiserfs_free(fs->dcache);
+	    fs->dcache = NULL;
+	}
+    }
+	
+    reiserfs_object_dcache_unlock();
+}
+
 int reiserfs_object_find_path(reiserfs_object_t *object, const char *name, 
     struct key *dirkey, int as_link) 
 {
     int name_len;
     uint32_t hash;
-    uint16_t *mode;
+    uint16_t mode = 0;
+    struct key parent, missing;
     char track[4096], path[4096];
-    char *pointer = NULL, *dirname = NULL;
+    char *pointer = NULL, *dirname = NULL, *pending = NULL;
     char path_separator[2] = {PATH_SEPARATOR, '\0'}; 
 	
     reiserfs_path_node_t *leaf;
@@ -302,28 +671,34 @@ int reiserfs_object_find_path(reiserfs_object_t *object, const char *name,
     pointer = &path[0];
     while (1) {
 	
-	/* Looking for stat data */
-	if (!(leaf = reiserfs_object_seek_by_offset(object, SD_OFFSET, 
-	    KEY_TYPE_SD, reiserfs_key_comp_four_components)))
-	{
-	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
-		_("Couldn't find stat data of directory %s."), track);
-	    return 0;
+	/* Looking for stat data, unless mode is known from the dentry cache */
+	if (!mode || LINUX_S_ISLNK(mode)) {
+	    if (!(leaf = reiserfs_object_seek_by_offset(object, SD_OFFSET, 
+		KEY_TYPE_SD, reiserfs_key_comp_four_components)))
+	    {
+		libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		    _("Couldn't find stat data of directory %s."), track);
+		return 0;
+	    }
+		
+	    mode = LE16_TO_CPU(*(uint16_t *)get_ih_item_body(leaf->node, 
+		get_ih_item_head(leaf->node, leaf->pos)));
+	    
+	    if (pending) {
+		reiserfs_object_dcache_insert(object->fs, &parent, pending, 
+		    &object->key, mode);
+		pending = NULL;
+	    }
 	}
 		
 	/* Checking whether found item is a link. */
-	mode = (uint16_t *)get_ih_item_body(leaf->node, get_ih_item_head(leaf->node, 
-	    leaf->pos));
-		
-	if (!LINUX_S_ISLNK(LE16_TO_CPU(*mode)) && !LINUX_S_ISDIR(LE16_TO_CPU(*mode)) && 
-	    !LINUX_S_ISREG(LE16_TO_CPU(*mode))) 
-	{
+	if (!LINUX_S_ISLNK(mode) && !LINUX_S_ISDIR(mode) && !LINUX_S_ISREG(mode)) {
 	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
 		_("%s has invalid object type."), track);
 	    return 0;
 	}
 		
-	if (LINUX_S_ISLNK(LE16_TO_CPU(*mode))) {
+	if (LINUX_S_ISLNK(mode)) {
 	    int is_terminator = dirname && 
 		!strchr((dirname + strlen(dirname) + 1), PATH_SEPARATOR);
 			
@@ -358,6 +733,19 @@ int reiserfs_object_find_path(reiserfs_object_t *object, const char *name,
 	    continue;
 		
 	strncat(track, dirname, strlen(dirname));
+	
+	if (reiserfs_object_dcache_find(object->fs, dirkey, dirname, 
+	    &object->key, &mode))
+	{
+	    if (get_key_objid(&object->key) == 0) {
+		libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		    _("Couldn't find entry %s."), track);
+		return 0;
+	    }
+	    
+	    track[strlen(track)] = PATH_SEPARATOR;
+	    continue;
+	}
 		
 	hash = reiserfs_fs_hash_value(object->fs, dirname);
 		
@@ -371,10 +759,18 @@ int reiserfs_object_find_path(reiserfs_object_t *object, const char *name,
 
 	/* Finding corresponding dir entry */
 	if (!reiserfs_object_find_entry(leaf, hash, &object->key)) {
+	    reiserfs_key_form(&missing, 0, 0, SD_OFFSET, KEY_TYPE_SD, KEY_FORMAT_1);
+	    reiserfs_object_dcache_insert(object->fs, dirkey, dirname, &missing, 0);
+	    
 	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
 		_("Couldn't find entry %s."), track);
 	    return 0;
 	}
+	
+	/* Entry is cached as soon as its mode is known */
+	memcpy(&parent, dirkey, sizeof(parent));
+	pending = dirname;
+	mode = 0;
 		
 	track[strlen(track)] = PATH_SEPARATOR;
     }
@@ -392,49 +788,103 @@ static void reiserfs_object_make_absolute_name(const char *name, char *buff, int
 	memcpy(buff, name, strlen(name));
 }
 
-reiserfs_object_t *reiserfs_object_create(reiserfs_fs_t *fs, 
-    const char *name, int as_link) 
+static reiserfs_object_t *reiserfs_object_alloc(reiserfs_fs_t *fs, 
+    uint32_t dirid, uint32_t objid)
 {
-    struct key dirkey; 
-    char absolute[4096];
     reiserfs_object_t *object;
 	
-    ASSERT(fs != NULL, return NULL);
-    ASSERT(name != NULL, return NULL);
-    ASSERT(strlen(name) > 0, return NULL);
-	
-    reiserfs_object_make_absolute_name(name, absolute, sizeof(absolute));
-	
     if (!(object = libreiserfs_calloc(sizeof(*object), 0)))
 	return NULL;
 	
-    if (!(object->path = reiserfs_path_create(MAX_HEIGHT)))
-	goto error_free_object;
+    if (!(object->path = reiserfs_path_create(MAX_HEIGHT))) {
+	libreiserfs_free(object);
+	return NULL;
+    }
 	
     object->fs = fs;
 	
-    reiserfs_key_form(&dirkey, ROOT_DIR_ID - 1, ROOT_OBJ_ID - 1, 
-	SD_OFFSET, KEY_TYPE_SD, reiserfs_fs_format(fs));
+    reiserfs_key_form(&object->key, dirid, objid, SD_OFFSET, 
+	KEY_TYPE_SD, reiserfs_fs_format(fs));
+	
+    return object;
+}
+
+/* 
+    Opens object by name relative to the directory with given key. Absolute 
+    names and NULL dirkey are resolved from the root directory.
+*/
+reiserfs_object_t *reiserfs_object_create_at(reiserfs_fs_t *fs, 
+    struct key *dirkey, const char *name, int as_link) 
+{
+    struct key parent; 
+    reiserfs_object_t *object;
+	
+    ASSERT(fs != NULL, return NULL);
+    ASSERT(name != NULL, return NULL);
+    ASSERT(strlen(name) > 0, return NULL);
+	
+    if (!dirkey || name[0] == PATH_SEPARATOR) {
+	reiserfs_key_form(&parent, ROOT_DIR_ID - 1, ROOT_OBJ_ID - 1, 
+	    SD_OFFSET, KEY_TYPE_SD, reiserfs_fs_format(fs));
 	
-    reiserfs_key_form(&object->key, ROOT_DIR_ID, ROOT_OBJ_ID, 
-    	SD_OFFSET, KEY_TYPE_SD, reiserfs_fs_format(fs));
+	if (!(object = reiserfs_object_alloc(fs, ROOT_DIR_ID, ROOT_OBJ_ID)))
+	    return NULL;
+    } else {
+	reiserfs_key_form(&parent, get_key_dirid(dirkey), get_key_objid(dirkey), 
+	    SD_OFFSET, KEY_TYPE_SD, reiserfs_fs_format(fs));
 	
-    if (!reiserfs_object_find_path(object, absolute, &dirkey, as_link))
-	goto error_free_path;
+	if (!(object = reiserfs_object_alloc(fs, get_key_dirid(dirkey), 
+		get_key_objid(dirkey))))
+	    return NULL;
+    }
+	
+    if (!reiserfs_object_find_path(object, name, &parent, as_link))
+	goto error_free_object;
 	
     if (!reiserfs_object_find_stat(object))
-	goto error_free_path;
+	goto error_free_object;
 	
     return object;
 	
-error_free_path:
-    reiserfs_path_free(object->path);    
 error_free_object:
-    libreiserfs_free(object);
-error:
+    reiserfs_object_free(object);
     return NULL;    
 }
 
+/* Opens object by its key without walking any path. Links aren't followed */
+reiserfs_object_t *reiserfs_object_create_by_key(reiserfs_fs_t *fs, 
+    struct key *key) 
+{
+    reiserfs_object_t *object;
+	
+    ASSERT(fs != NULL, return NULL);
+    ASSERT(key != NULL, return NULL);
+	
+    if (!(object = reiserfs_object_alloc(fs, get_key_dirid(key), 
+	    get_key_objid(key))))
+	return NULL;
+	
+    if (!reiserfs_object_find_stat(object)) {
+	reiserfs_object_free(object);
+	return NULL;
+    }
+	
+    return object;
+}
+
+reiserfs_object_t *reiserfs_object_create(reiserfs_fs_t *fs, 
+    const char *name, int as_link) 
+{
+    char absolute[4096];
+	
+    ASSERT(fs != NULL, return NULL);
+    ASSERT(name != NULL, return NULL);
+    ASSERT(strlen(name) > 0, return NULL);
+	
+    reiserfs_object_make_absolute_name(name, absolute, sizeof(absolute));
+    return reiserfs_object_create_at(fs, NULL, absolute, as_link);
+}
+
 int reiserfs_object_is_reg(reiserfs_object_t *object) {
     return LINUX_S_ISREG(object->stat.st_mode);
 }
@@ -33,8 +33,37 @@ struct reiserfs_reloc_desc {
 	
     reiserfs_gauge_t *gauge;
     blk_t counter;
+
+    /* Reserved free extent and the number of blocks wanted next */
+    blk_t extent_start;
+    count_t extent_len;
+    count_t want;
 };
 
+static int generic_extent_reserve(struct reiserfs_reloc_desc *reloc, blk_t hint) {
+    blk_t start;
+    count_t len;
+    
+    if (!(start = reiserfs_fs_bitmap_find_free_extent(reloc->dst_fs, hint, 1, 
+	    reloc->want ? reloc->want : 1, &len)))
+	return 0;
+
+    reiserfs_fs_bitmap_use_range(reloc->dst_fs, start, len);
+    
+    reloc->extent_start = start;
+    reloc->extent_len = len;
+    
+    return 1;
+}
+
+static void generic_extent_release(struct reiserfs_reloc_desc *reloc) {
+    if (reloc->extent_len) {
+	reiserfs_fs_bitmap_unuse_range(reloc->dst_fs, reloc->extent_start, 
+	    reloc->extent_len);
+    }
+    reloc->extent_len = 0;
+}
+
 static blk_t generic_node_write(struct reiserfs_reloc_desc *reloc, reiserfs_block_t *node) {
     blk_t dst_blk, offset;
     reiserfs_fs_t *src_fs, *dst_fs;
@@ -58,9 +87,9 @@ static blk_t generic_node_write(struct reiserfs_reloc_desc *reloc, reiserfs_bloc
 	
     offset = (reloc->smart ? (reloc->dst_segment->start - reloc->src_segment->start) : 0);
 	
-    /* Finding free block */
-    if (!(dst_blk = reiserfs_fs_bitmap_find_free_block(dst_fs, reloc->dst_segment->start - 
-	(reloc->src_segment->start < reloc->dst_segment->start ? offset : 0)))) 
+    /* Taking free block from reserved extent, finding new extent if needed */
+    if (!reloc->extent_len && !generic_extent_reserve(reloc, reloc->dst_segment->start - 
+	(reloc->src_segment->start < reloc->dst_segment->start ? offset : 0))) 
     {
 	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
 	    _("Couldn't find free block inside allowed area (%lu - %lu)."), 
@@ -68,10 +97,11 @@ static blk_t generic_node_write(struct reiserfs_reloc_desc *reloc, reiserfs_bloc
 	return 0;
     }
 
+    dst_blk = reloc->extent_start++;
+    reloc->extent_len--;
+    
     reiserfs_block_set_nr(node, dst_blk + (reloc->src_segment->start < 
 	    reloc->dst_segment->start ? offset : 0));
-	
-    reiserfs_fs_bitmap_use_block(dst_fs, dst_blk);
 
     if (!reiserfs_block_write(dst_fs->dal, node)) {
 	reiserfs_block_writing_failed(reiserfs_block_get_nr(node),
@@ -119,6 +149,10 @@ static long callback_node_setup(reiserfs_block_t *node, struct reiserfs_reloc_de
 	    /* Moving the all pieces of a big file */
 	    if (is_indirect_ih(item)) {
 		uint32_t unfm, *blocks = (uint32_t *)get_ih_item_body(node, item);
+
+		/* Pieces are placed into as few free extents as possible */
+		for (reloc->want = 0, unfm = 0; unfm < get_ih_unfm_nr(item); unfm++)
+		    reloc->want += (blocks[unfm] != 0);
 	    
 		for (unfm = 0; unfm < get_ih_unfm_nr(item); unfm++) {
 		    if (blocks[unfm] != 0) {
@@ -134,8 +168,12 @@ static long callback_node_setup(reiserfs_block_t *node, struct reiserfs_reloc_de
 			}
 			blocks[unfm] = CPU_TO_LE32(blk);
 			reiserfs_block_free(node);
+			reloc->want--;
 		    }
 		}
+		
+		generic_extent_release(reloc);
+		reloc->want = 1;
 	    }
 	}
 	reiserfs_block_mark_dirty(node);
@@ -207,6 +245,7 @@ void reiserfs_segment_free(reiserfs_segment_t *segment) {
 blk_t reiserfs_segment_relocate(reiserfs_fs_t *dst_fs, reiserfs_segment_t *dst_segment, 
     reiserfs_fs_t *src_fs, reiserfs_segment_t *src_segment, int smart) 
 {
+    blk_t root_blk;
     struct reiserfs_reloc_desc reloc;
 	
     ASSERT(dst_segment != NULL, return 0);
@@ -221,12 +260,21 @@ blk_t reiserfs_segment_relocate(reiserfs_fs_t *dst_fs, reiserfs_segment_t *dst_s
     reloc.src_fs = src_fs;
     reloc.smart = smart;
     reloc.counter = 0;
+    reloc.extent_len = 0;
+    reloc.want = 1;
 
-    return reiserfs_tree_traverse(reiserfs_fs_tree(src_fs), &reloc, 
+    /* Tree nodes are about to be moved, cached stat data places go stale */
+    reiserfs_object_scache_invalidate(src_fs, 0);
+    reiserfs_object_scache_invalidate(dst_fs, 0);
+
+    root_blk = reiserfs_tree_traverse(reiserfs_fs_tree(src_fs), &reloc, 
 	(reiserfs_edge_traverse_func_t)callback_node_check, 
 	(reiserfs_node_func_t)callback_node_setup, 
 	(reiserfs_chld_func_t)callback_chld_setup, 
 	(reiserfs_edge_traverse_func_t)callback_node_write);
+    
+    generic_extent_release(&reloc);
+    return root_blk;
 }
 
 int reiserfs_segment_test_inside(reiserfs_segment_t *segment, blk_t blk) {
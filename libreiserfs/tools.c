@@ -25,6 +25,372 @@
 #include <reiserfs/endian.h>
 #include <reiserfs/tools.h>
 
+#if defined(__GNUC__) && __GNUC__ >= 5 && (defined(__x86_64__) || defined(__i386__))
+#  define TOOLS_X86_SIMD
+#  include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+#  define reiserfs_tools_ctz64(word) 		__builtin_ctzll(word)
+#  define reiserfs_tools_popcount64(word) 	__builtin_popcountll(word)
+#else
+static inline int reiserfs_tools_ctz64(uint64_t word) {
+    int result = 0;
+
+    while (!(word & 1)) {
+	result++;
+	word >>= 1;
+    }
+    return result;
+}
+
+static inline int reiserfs_tools_popcount64(uint64_t word) {
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((word * 0x0101010101010101ULL) >> 56);
+}
+#endif
+
+/* 
+    Word-level bit kernels. Bit N of a map lives in byte N / 8 under mask 
+    1 << (N % 8) on any cpu, so a map loaded as little endian 64-bit words 
+    keeps bit N of the map in bit N % 64 of word N / 64.
+*/
+static inline uint64_t reiserfs_tools_load64(const uint8_t *p, unsigned long bytes) {
+    uint64_t word = 0;
+
+    memcpy(&word, p, bytes < sizeof(word) ? bytes : sizeof(word));
+    return LE64_TO_CPU(word);
+}
+
+/*
+    Byte run kernels. Skip returns count of leading bytes equal to the given
+    value rounded down to whole 64-bit words, count returns set bits in the
+    given bytes. They are selected once at runtime by cpu features.
+*/
+typedef unsigned long (*reiserfs_tools_skip_func_t)(const uint8_t *, 
+    unsigned long, uint8_t);
+
+typedef unsigned long (*reiserfs_tools_count_func_t)(const uint8_t *, 
+    unsigned long);
+
+static unsigned long reiserfs_tools_generic_skip(const uint8_t *p, 
+    unsigned long len, uint8_t value) 
+{
+    unsigned long i;
+    uint64_t pattern = (value ? ~0ULL : 0);
+
+    for (i = 0; i + 8 <= len; i += 8) {
+	if (reiserfs_tools_load64(p + i, 8) != pattern)
+	    break;
+    }
+    return i;
+}
+
+static unsigned long reiserfs_tools_generic_count(const uint8_t *p, 
+    unsigned long len) 
+{
+    unsigned long i, count = 0;
+
+    for (i = 0; i + 8 <= len; i += 8)
+	count += reiserfs_tools_popcount64(reiserfs_tools_load64(p + i, 8));
+
+    if (i < len)
+	count += reiserfs_tools_popcount64(reiserfs_tools_load64(p + i, len - i));
+
+    return count;
+}
+
+#ifdef TOOLS_X86_SIMD
+
+__attribute__((target("sse2"))) 
+static unsigned long reiserfs_tools_sse_skip(const uint8_t *p, 
+    unsigned long len, uint8_t value) 
+{
+    unsigned long i;
+    __m128i pattern = _mm_set1_epi8((char)value);
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	__m128i chunk = _mm_loadu_si128((const __m128i *)(p + i));
+	
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern)) != 0xffff)
+	    break;
+    }
+    return i + reiserfs_tools_generic_skip(p + i, len - i, value);
+}
+
+__attribute__((target("popcnt"))) 
+static unsigned long reiserfs_tools_sse_count(const uint8_t *p, 
+    unsigned long len) 
+{
+    unsigned long i, count = 0;
+
+    for (i = 0; i + 8 <= len; i += 8)
+	count += __builtin_popcountll(reiserfs_tools_load64(p + i, 8));
+    
+    return count + reiserfs_tools_generic_count(p + i, len - i);
+}
+
+__attribute__((target("avx2"))) 
+static unsigned long reiserfs_tools_avx2_skip(const uint8_t *p, 
+    unsigned long len, uint8_t value) 
+{
+    unsigned long i;
+    __m256i pattern = _mm256_set1_epi8((char)value);
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	__m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+	
+	if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, pattern)) != 
+		0xffffffff)
+	    break;
+    }
+    return i + reiserfs_tools_generic_skip(p + i, len - i, value);
+}
+
+/* Nibble lookup popcount, summed up into 64-bit lanes by sad */
+__attribute__((target("avx2"))) 
+static unsigned long reiserfs_tools_avx2_count(const uint8_t *p, 
+    unsigned long len) 
+{
+    unsigned long i;
+    uint64_t lanes[4];
+    
+    __m256i sum = _mm256_setzero_si256();
+    __m256i mask = _mm256_set1_epi8(0x0f);
+    __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	__m256i chunk = _mm256_loadu_si256((const __m256i *)(p + i));
+	__m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(chunk, mask));
+	__m256i hi = _mm256_shuffle_epi8(table, 
+	    _mm256_and_si256(_mm256_srli_epi16(chunk, 4), mask));
+	
+	sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_add_epi8(lo, hi), 
+	    _mm256_setzero_si256()));
+    }
+
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + 
+	reiserfs_tools_generic_count(p + i, len - i);
+}
+
+#endif
+
+static unsigned long reiserfs_tools_select_skip(const uint8_t *p, 
+    unsigned long len, uint8_t value);
+
+static unsigned long reiserfs_tools_select_count(const uint8_t *p, 
+    unsigned long len);
+
+static reiserfs_tools_skip_func_t reiserfs_tools_skip = reiserfs_tools_select_skip;
+static reiserfs_tools_count_func_t reiserfs_tools_count = reiserfs_tools_select_count;
+
+/* Selecting is idempotent, so racing threads just store the same pointers */
+static void reiserfs_tools_select_kernels(void) {
+    reiserfs_tools_skip_func_t skip = reiserfs_tools_generic_skip;
+    reiserfs_tools_count_func_t count = reiserfs_tools_generic_count;
+
+#ifdef TOOLS_X86_SIMD
+    __builtin_cpu_init();
+    
+    if (__builtin_cpu_supports("avx2")) {
+	skip = reiserfs_tools_avx2_skip;
+	count = reiserfs_tools_avx2_count;
+    } else {
+	if (__builtin_cpu_supports("sse2"))
+	    skip = reiserfs_tools_sse_skip;
+	
+	if (__builtin_cpu_supports("popcnt"))
+	    count = reiserfs_tools_sse_count;
+    }
+#endif
+
+    reiserfs_tools_skip = skip;
+    reiserfs_tools_count = count;
+}
+
+static unsigned long reiserfs_tools_select_skip(const uint8_t *p, 
+    unsigned long len, uint8_t value)
+{
+    reiserfs_tools_select_kernels();
+    return reiserfs_tools_skip(p, len, value);
+}
+
+static unsigned long reiserfs_tools_select_count(const uint8_t *p, 
+    unsigned long len)
+{
+    reiserfs_tools_select_kernels();
+    return reiserfs_tools_count(p, len);
+}
+
+static unsigned long reiserfs_tools_find_next(const void *vaddr, 
+    unsigned long size, unsigned long offset, int set) 
+{
+    uint64_t word, flip;
+    unsigned long bit, bytes;
+    const uint8_t *addr = vaddr;
+    
+    if (offset >= size)
+	return size;
+
+    /* Searching for zero is searching for set bit in inverted word */
+    flip = (set ? 0 : ~0ULL);
+    bytes = (size + 7) >> 3;
+    
+    bit = offset & ~63UL;
+    word = (reiserfs_tools_load64(addr + (bit >> 3), bytes - (bit >> 3)) ^ flip) & 
+	(~0ULL << (offset & 63));
+
+    while (!word) {
+	if ((bit += 64) >= size)
+	    return size;
+
+	bit += reiserfs_tools_skip(addr + (bit >> 3), bytes - (bit >> 3), 
+	    (set ? 0 : 0xff)) << 3;
+	
+	if (bit >= size)
+	    return size;
+	
+	word = reiserfs_tools_load64(addr + (bit >> 3), bytes - (bit >> 3)) ^ flip;
+    }
+
+    bit += reiserfs_tools_ctz64(word);
+    return (bit < size ? bit : size);
+}
+
+unsigned long reiserfs_tools_find_next_zero(const void *vaddr, 
+    unsigned long size, unsigned long offset) 
+{
+    return reiserfs_tools_find_next(vaddr, size, offset, 0);
+}
+
+unsigned long reiserfs_tools_find_next_set(const void *vaddr, 
+    unsigned long size, unsigned long offset) 
+{
+    return reiserfs_tools_find_next(vaddr, size, offset, 1);
+}
+
+static inline uint64_t reiserfs_tools_mask64(unsigned long from, unsigned long to) {
+    uint64_t mask = ~0ULL << from;
+
+    if (to < 64)
+	mask &= ~(~0ULL << to);
+    
+    return mask;
+}
+
+unsigned long reiserfs_tools_count_bits(const void *vaddr, 
+    unsigned long start, unsigned long end) 
+{
+    unsigned long count = 0, head, tail;
+    const uint8_t *addr = vaddr;
+
+    if (start >= end)
+	return 0;
+
+    head = (start + 63) & ~63UL;
+    tail = end & ~63UL;
+
+    /* The range lies within one word */
+    if (head > tail) {
+	return reiserfs_tools_popcount64(reiserfs_tools_load64(addr + 
+	    ((start & ~63UL) >> 3), ((end + 7) >> 3) - ((start & ~63UL) >> 3)) & 
+	    reiserfs_tools_mask64(start & 63, end - (start & ~63UL)));
+    }
+    
+    if (start < head) {
+	count += reiserfs_tools_popcount64(reiserfs_tools_load64(addr + 
+	    ((start & ~63UL) >> 3), 8) & reiserfs_tools_mask64(start & 63, 64));
+    }
+    
+    count += reiserfs_tools_count(addr + (head >> 3), (tail - head) >> 3);
+
+    if (tail < end) {
+	count += reiserfs_tools_popcount64(reiserfs_tools_load64(addr + (tail >> 3), 
+	    ((end + 7) >> 3) - (tail >> 3)) & reiserfs_tools_mask64(0, end - tail));
+    }
+    
+    return count;
+}
+
+static void reiserfs_tools_fill_bits(void *vaddr, unsigned long start, 
+    unsigned long end, int set) 
+{
+    unsigned long head, tail;
+    uint8_t *addr = vaddr, mask;
+
+    if (start >= end)
+	return;
+
+    head = (start + 7) & ~7UL;
+    tail = end & ~7UL;
+
+    /* The range lies within one byte */
+    if (head > tail) {
+	mask = (uint8_t)((0xff << (start & 7)) & ~(0xff << (end - (start & ~7UL))));
+	addr[start >> 3] = (set ? addr[start >> 3] | mask : addr[start >> 3] & ~mask);
+	return;
+    }
+
+    if (start < head) {
+	mask = (uint8_t)(0xff << (start & 7));
+	addr[start >> 3] = (set ? addr[start >> 3] | mask : addr[start >> 3] & ~mask);
+    }
+
+    memset(addr + (head >> 3), (set ? 0xff : 0), (tail - head) >> 3);
+
+    if (tail < end) {
+	mask = (uint8_t)~(0xff << (end - tail));
+	addr[tail >> 3] = (set ? addr[tail >> 3] | mask : addr[tail >> 3] & ~mask);
+    }
+}
+
+void reiserfs_tools_set_bits(void *vaddr, unsigned long start, unsigned long end) {
+    reiserfs_tools_fill_bits(vaddr, start, end, 1);
+}
+
+void reiserfs_tools_clear_bits(void *vaddr, unsigned long start, unsigned long end) {
+    reiserfs_tools_fill_bits(vaddr, start, end, 0);
+}
+
+int reiserfs_tools_comp_bits(const void *vaddr1, const void *vaddr2, 
+    unsigned long start, unsigned long end) 
+{
+    unsigned long head, tail, bytes;
+    const uint8_t *addr1 = vaddr1, *addr2 = vaddr2;
+
+    if (start >= end)
+	return 0;
+
+    head = (start + 7) & ~7UL;
+    tail = end & ~7UL;
+    bytes = (end + 7) >> 3;
+
+    if (head > tail) {
+	uint64_t mask = reiserfs_tools_mask64(start & 7, end - (start & ~7UL));
+	
+	return ((reiserfs_tools_load64(addr1 + (start >> 3), bytes - (start >> 3)) ^ 
+	    reiserfs_tools_load64(addr2 + (start >> 3), bytes - (start >> 3))) & mask) != 0;
+    }
+
+    if (start < head && ((addr1[start >> 3] ^ addr2[start >> 3]) & 
+	    (uint8_t)(0xff << (start & 7))))
+	return 1;
+    
+    if (memcmp(addr1 + (head >> 3), addr2 + (head >> 3), (tail - head) >> 3))
+	return 1;
+
+    if (tail < end && ((addr1[tail >> 3] ^ addr2[tail >> 3]) & 
+	    (uint8_t)~(0xff << (end - tail))))
+	return 1;
+    
+    return 0;
+}
+
 static inline int reiserfs_tools_le_set_bit(int nr, void *addr) {
     uint8_t * p, mask;
     int retval;
@@ -63,45 +429,13 @@ static inline int reiserfs_tools_le_test_bit(int nr, const void *addr) {
 }
 
 static inline int reiserfs_tools_le_find_first_zero_bit(const void *vaddr, unsigned size) {
-    const uint8_t *p = vaddr, *addr = vaddr;
-    int res;
-
-    if (!size)
-	return 0;
-
-    size = (size >> 3) + ((size & 0x7) > 0);
-    while (*p++ == 255) {
-	if (--size == 0)
-	return (p - addr) << 3;
-    }
-  
-    --p;
-    for (res = 0; res < 8; res++)
-	if (!reiserfs_tools_test_bit (res, p)) break;
-    return (p - addr) * 8 + res;
+    return reiserfs_tools_find_next(vaddr, size, 0, 0);
 }
 
 static inline int reiserfs_tools_le_find_next_zero_bit(const void *vaddr, 
     unsigned size, unsigned offset) 
 {
-    const uint8_t *addr = vaddr;
-    const uint8_t *p = addr + (offset >> 3);
-    int bit = offset & 7, res;
-  
-    if (offset >= size)
-	return size;
-  
-    if (bit) {
-	/* Look for zero in first char */
-	for (res = bit; res < 8; res++)
-	    if (!reiserfs_tools_test_bit (res, p))
-		return (p - addr) * 8 + res;
-	    p++;
-    }
-
-    /* No zero yet, search remaining full bytes for a zero */
-    res = reiserfs_tools_find_first_zero_bit (p, size - 8 * (p - addr));
-    return (p - addr) * 8 + res;
+    return reiserfs_tools_find_next(vaddr, size, offset, 0);
 }
 
 static inline int reiserfs_tools_be_set_bit(int nr, void *addr) {
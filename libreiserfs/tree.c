@@ -296,9 +296,6 @@ static int reiserfs_tree_node_lookup(reiserfs_tree_t *tree, blk_t blk,
 	
     if (!comp_func) return 0;
 	
-    if (path)
-	reiserfs_path_clear(path);
-	
     while (1) {
 	if (!(node = reiserfs_block_read(tree->fs->dal, blk)))
 	    reiserfs_block_reading_failed(blk, dal_error(tree->fs->dal), return 0);
@@ -346,6 +343,9 @@ reiserfs_path_node_t *reiserfs_tree_lookup_internal(reiserfs_tree_t *tree, blk_t
     if (tree && reiserfs_tree_get_height(tree) < 2)
 	return NULL;
 
+    if (path)
+	reiserfs_path_clear(path);
+	
     return (reiserfs_tree_node_lookup(tree, from, comp_func, key, 0, path) ? 
 	reiserfs_path_last(path) : NULL);
 }
@@ -356,10 +356,173 @@ reiserfs_path_node_t *reiserfs_tree_lookup_leaf(reiserfs_tree_t *tree, blk_t fro
     if (tree && reiserfs_tree_get_height(tree) < 2)
 	return NULL;
 	
+    if (path)
+	reiserfs_path_clear(path);
+	
     return (reiserfs_tree_node_lookup(tree, from, comp_func, key, 1, path) ? 
 	reiserfs_path_last(path) : NULL);
 }
 
+/* Checks if key lies between delimiting keys of the child path node points to */
+static int reiserfs_tree_child_covers(reiserfs_path_node_t *parent, 
+    reiserfs_comp_func_t comp_func, struct key *key)
+{
+    if (parent->pos > 0 && comp_func(key, 
+	    get_node_key(parent->node, parent->pos - 1)) < 0)
+	return 0;
+	
+    if (parent->pos < get_node_nritems(get_node_head(parent->node)) && 
+	    comp_func(key, get_node_key(parent->node, parent->pos)) >= 0)
+	return 0;
+	
+    return 1;
+}
+
+/*
+    Looks key up reusing the path of a previous leaf lookup. Path is cut 
+    below the lowest node key lies in and lookup goes down from there. 
+    So close keys looked up in ascending order share the descent and every 
+    leaf is read once.
+*/
+reiserfs_path_node_t *reiserfs_tree_lookup_near(reiserfs_tree_t *tree, 
+    reiserfs_comp_func_t comp_func, struct key *key, reiserfs_path_t *path)
+{
+    blk_t blk;
+    uint32_t pos = 0, level;
+    reiserfs_path_node_t *last;
+	
+    ASSERT(tree != NULL, return NULL);
+    ASSERT(key != NULL, return NULL);
+    ASSERT(path != NULL, return NULL);
+	
+    if (reiserfs_path_empty(path)) {
+	return reiserfs_tree_lookup_leaf(tree, reiserfs_tree_get_root(tree), 
+	    comp_func, key, path);
+    }
+	
+    /* Edge children are bounded by upper nodes, so checking from the root */
+    for (level = 1; level < path->length; level++) {
+	if (!reiserfs_tree_child_covers(path->nodes[level - 1], comp_func, key))
+	    break;
+    }
+	
+    while (path->length > level) {
+	reiserfs_path_node_free(path->nodes[path->length - 1]);
+	path->nodes[--path->length] = NULL;
+    }
+	
+    last = reiserfs_path_last(path);
+	
+    /* Key lies in the same leaf, so it is searched right there */
+    if (is_leaf_node(last->node)) {
+	int found = reiserfs_tools_fast_search(key, get_ih_item_head(last->node, 0), 
+	    get_node_nritems(get_node_head(last->node)), IH_SIZE, comp_func, &pos);
+	
+	last->pos = pos;
+	return (found ? last : NULL);
+    }
+	
+    blk = reiserfs_block_get_nr(last->node);
+	
+    reiserfs_path_node_free(last);
+    path->nodes[--path->length] = NULL;
+	
+    return (reiserfs_tree_node_lookup(tree, blk, comp_func, key, 1, path) ? 
+	reiserfs_path_last(path) : NULL);
+}
+
+/* Returns right delimiting key of the last path node, NULL for the rightmost one */
+struct key *reiserfs_tree_right_key(reiserfs_path_t *path) {
+    reiserfs_path_node_t *node;
+	
+    ASSERT(path != NULL, return NULL);
+	
+    if (!(node = reiserfs_path_last(path)))
+	return NULL;
+	
+    for (node = node->parent; node; node = node->parent) {
+	if (node->pos < get_node_nritems(get_node_head(node->node)))
+	    return get_node_key(node->node, node->pos);
+    }
+	
+    return NULL;
+}
+
+/* Returns left delimiting key of the last path node, NULL for the leftmost one */
+struct key *reiserfs_tree_left_key(reiserfs_path_t *path) {
+    reiserfs_path_node_t *node;
+	
+    ASSERT(path != NULL, return NULL);
+	
+    if (!(node = reiserfs_path_last(path)))
+	return NULL;
+	
+    for (node = node->parent; node; node = node->parent) {
+	if (node->pos > 0)
+	    return get_node_key(node->node, node->pos - 1);
+    }
+	
+    return NULL;
+}
+
+/*
+    Moves the path built by lookup to the leaf at the right of its last node.
+    Returns NULL when the rightmost leaf has been passed, path is cleared then.
+*/
+reiserfs_path_node_t *reiserfs_tree_next_leaf(reiserfs_tree_t *tree,
+    reiserfs_path_t *path)
+{
+    blk_t blk;
+    reiserfs_block_t *node;
+    reiserfs_path_node_t *parent;
+
+    ASSERT(tree != NULL, return NULL);
+    ASSERT(path != NULL, return NULL);
+
+    /* Going up till a parent which has a child at the right */
+    do {
+	if (reiserfs_path_empty(path))
+	    return NULL;
+
+	reiserfs_path_node_free(path->nodes[path->length - 1]);
+	path->nodes[--path->length] = NULL;
+
+	if (!(parent = reiserfs_path_last(path)))
+	    return NULL;
+    } while (parent->pos >= get_node_nritems(get_node_head(parent->node)));
+
+    parent->pos++;
+
+    /* And down by the leftmost children */
+    while (1) {
+	blk = get_dc_child_blocknr(get_node_disk_child(parent->node,
+	    parent->pos)) + tree->offset;
+
+	if (!(node = reiserfs_block_read(tree->fs->dal, blk)))
+	    reiserfs_block_reading_failed(blk, dal_error(tree->fs->dal), goto error);
+
+	if (!is_leaf_node(node) && !is_internal_node(node)) {
+	    libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL,
+		_("Invalid node detected (%lu). Unknown type."), blk);
+	    goto error_free_node;
+	}
+
+	if (!reiserfs_path_inc(path, reiserfs_path_node_create(parent, node, 0)))
+	    goto error_free_node;
+
+	if (is_leaf_node(node))
+	    return reiserfs_path_last(path);
+
+	parent = reiserfs_path_last(path);
+    }
+
+error_free_node:
+    reiserfs_block_free(node);
+error:
+    reiserfs_path_clear(path);
+    return NULL;
+}
+
 static long reiserfs_tree_node_traverse(reiserfs_tree_t *tree, blk_t blk, void *data,
     reiserfs_edge_traverse_func_t before_node_func, reiserfs_node_func_t node_func, 
     reiserfs_chld_func_t chld_func, reiserfs_edge_traverse_func_t after_node_func)
@@ -435,6 +598,276 @@ long reiserfs_tree_traverse(reiserfs_tree_t *tree, void *data,
     	data, before_node_func, node_func, chld_func, after_node_func);
 }
 
+/*
+    Estimation key range is half-open [start, end). NULL start or end means
+    that range isn't limited from that side. The same is true for delimiting
+    keys of a node, NULL means leftmost or rightmost node of the tree.
+*/
+static int reiserfs_tree_range_overlaps(struct key *start, struct key *end,
+    struct key *lkey, struct key *rkey)
+{
+    if (start && rkey && reiserfs_key_comp_four_components(rkey, start) <= 0)
+	return 0;
+
+    if (end && lkey && reiserfs_key_comp_four_components(lkey, end) >= 0)
+	return 0;
+
+    return 1;
+}
+
+static int reiserfs_tree_range_covers(struct key *start, struct key *end,
+    struct key *lkey, struct key *rkey)
+{
+    if (start && (!lkey || reiserfs_key_comp_four_components(lkey, start) < 0))
+	return 0;
+
+    if (end && (!rkey || reiserfs_key_comp_four_components(rkey, end) > 0))
+	return 0;
+
+    return 1;
+}
+
+static void reiserfs_tree_leaf_estimate(reiserfs_block_t *node, struct key *start,
+    struct key *end, reiserfs_tree_estimate_t *estimate)
+{
+    uint32_t i;
+    reiserfs_item_head_t *item;
+
+    for (i = 0; i < get_node_nritems(get_node_head(node)); i++) {
+	item = get_ih_item_head(node, i);
+
+	if (start && reiserfs_key_comp_four_components(&item->ih_key, start) < 0)
+	    continue;
+
+	if (end && reiserfs_key_comp_four_components(&item->ih_key, end) >= 0)
+	    break;
+
+	estimate->items++;
+	estimate->bytes += IH_SIZE + get_ih_item_len(item);
+    }
+}
+
+static int reiserfs_tree_node_estimate(reiserfs_tree_t *tree, blk_t blk,
+    struct key *start, struct key *end, struct key *lkey, struct key *rkey,
+    int exact, reiserfs_tree_estimate_t *estimate)
+{
+    uint32_t i, nritems;
+    reiserfs_block_t *node;
+
+    if (!(node = reiserfs_block_read(tree->fs->dal, blk)))
+	reiserfs_block_reading_failed(blk, dal_error(tree->fs->dal), goto error);
+
+    /* We are here for a leaf only in exact mode or when root is a leaf */
+    if (is_leaf_node(node)) {
+	estimate->leaves++;
+
+	if (exact)
+	    reiserfs_tree_leaf_estimate(node, start, end, estimate);
+	else {
+	    uint32_t size = MAX_CHILD_SIZE(reiserfs_fs_block_size(tree->fs)) -
+		get_node_free_space(get_node_head(node));
+
+	    estimate->bytes += (reiserfs_tree_range_covers(start, end, lkey, rkey) ?
+		size : size / 2);
+	}
+
+	reiserfs_block_free(node);
+	return 1;
+    }
+
+    if (!is_internal_node(node)) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL,
+	    _("Invalid node detected (%lu). Unknown type."), blk);
+	goto error_free_node;
+    }
+
+    estimate->internals++;
+    nritems = get_node_nritems(get_node_head(node));
+
+    for (i = 0; i <= nritems; i++) {
+	reiserfs_disk_child_t *child = get_node_disk_child(node, i);
+	struct key *chld_lkey = (i == 0 ? lkey : get_node_key(node, i - 1));
+	struct key *chld_rkey = (i == nritems ? rkey : get_node_key(node, i));
+
+	if (!reiserfs_tree_range_overlaps(start, end, chld_lkey, chld_rkey))
+	    continue;
+
+	/* Children are leaves, so their sizes may be taken from disk_child */
+	if (!exact && get_node_level(get_node_head(node)) == LEAF_LEVEL + 1) {
+	    uint32_t size = get_dc_child_size(child);
+
+	    estimate->leaves++;
+	    estimate->bytes += (reiserfs_tree_range_covers(start, end, chld_lkey,
+		chld_rkey) ? size : size / 2);
+	    continue;
+	}
+
+	if (!reiserfs_tree_node_estimate(tree, get_dc_child_blocknr(child) +
+		tree->offset, start, end, chld_lkey, chld_rkey, exact, estimate))
+	    goto error_free_node;
+    }
+
+    reiserfs_block_free(node);
+    return 1;
+
+error_free_node:
+    reiserfs_block_free(node);
+error:
+    return 0;
+}
+
+int reiserfs_tree_estimate(reiserfs_tree_t *tree, struct key *start,
+    struct key *end, int exact, reiserfs_tree_estimate_t *estimate)
+{
+    ASSERT(tree != NULL, return 0);
+    ASSERT(estimate != NULL, return 0);
+
+    memset(estimate, 0, sizeof(*estimate));
+
+    if (reiserfs_tree_get_height(tree) < 2)
+	return 1;
+
+    if (!reiserfs_tree_node_estimate(tree, reiserfs_tree_get_root(tree) +
+	    tree->offset, start, end, NULL, NULL, exact, estimate))
+	return 0;
+
+    if (!exact)
+	estimate->items = (estimate->bytes + ESTIMATE_ITEM_SIZE - 1) /
+	    ESTIMATE_ITEM_SIZE;
+
+    return 1;
+}
+
+int reiserfs_tree_estimate_dirid(reiserfs_tree_t *tree, uint32_t dirid,
+    int exact, reiserfs_tree_estimate_t *estimate)
+{
+    struct key start, end;
+
+    memset(&start, 0, sizeof(start));
+    memset(&end, 0, sizeof(end));
+
+    set_key_dirid(&start, dirid);
+    set_key_dirid(&end, dirid + 1);
+
+    return reiserfs_tree_estimate(tree, &start, (dirid == 0xffffffff ? NULL : &end),
+	exact, estimate);
+}
+
+static int reiserfs_tree_blk_comp(const void *blk1, const void *blk2) {
+    if (*(blk_t *)blk1 == *(blk_t *)blk2)
+	return 0;
+	
+    return (*(blk_t *)blk1 < *(blk_t *)blk2 ? -1 : 1);
+}
+
+static int reiserfs_tree_blk_add(blk_t **blks, uint32_t *count, 
+    uint32_t *max, blk_t blk)
+{
+    if (*count == *max) {
+	if (!libreiserfs_realloc((void **)blks, (*max ? *max * 2 : 256) * 
+		sizeof(blk_t)))
+	    return 0;
+	
+	*max = (*max ? *max * 2 : 256);
+    }
+	
+    (*blks)[(*count)++] = blk;
+    return 1;
+}
+
+/* 
+    Collects block numbers of all leaves, sorted in ascending order. Internal 
+    nodes are read level by level, each level in ascending block order, and 
+    leaves themselves aren't read. Caller frees the returned array.
+*/
+int reiserfs_tree_leaves(reiserfs_tree_t *tree, blk_t **leaves, uint32_t *count) {
+    uint32_t i, j, level_count, next_count = 0, next_max = 0, max = 0;
+    blk_t blk, *level, *next = NULL;
+    reiserfs_block_t *node;
+	
+    ASSERT(tree != NULL, return 0);
+    ASSERT(leaves != NULL, return 0);
+    ASSERT(count != NULL, return 0);
+	
+    *leaves = NULL;
+    *count = 0;
+	
+    if (reiserfs_tree_get_height(tree) < 2)
+	return 1;
+	
+    if (!(level = libreiserfs_calloc(sizeof(*level), 0)))
+	return 0;
+	
+    level[0] = reiserfs_tree_get_root(tree) + tree->offset;
+    level_count = 1;
+	
+    while (level_count > 0) {
+	qsort(level, level_count, sizeof(*level), reiserfs_tree_blk_comp);
+	
+	for (i = 0; i < level_count; i++) {
+	    if (!(node = reiserfs_block_read(tree->fs->dal, level[i])))
+		reiserfs_block_reading_failed(level[i], dal_error(tree->fs->dal), 
+		    goto error_free_next);
+	    
+	    if (is_leaf_node(node)) {
+		if (!reiserfs_tree_blk_add(leaves, count, &max, level[i]))
+		    goto error_free_node;
+	    } else if (is_internal_node(node)) {
+		for (j = 0; j <= get_node_nritems(get_node_head(node)); j++) {
+		    blk = get_dc_child_blocknr(get_node_disk_child(node, j)) + 
+			tree->offset;
+		    
+		    if (get_node_level(get_node_head(node)) == LEAF_LEVEL + 1) {
+			if (!reiserfs_tree_blk_add(leaves, count, &max, blk))
+			    goto error_free_node;
+		    } else {
+			if (!reiserfs_tree_blk_add(&next, &next_count, &next_max, blk))
+			    goto error_free_node;
+		    }
+		}
+	    } else {
+		libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 
+		    _("Invalid node detected (%lu). Unknown type."), level[i]);
+		goto error_free_node;
+	    }
+	    
+	    reiserfs_block_free(node);
+	}
+	
+	libreiserfs_free(level);
+	
+	level = next;
+	level_count = next_count;
+	
+	next = NULL;
+	next_count = next_max = 0;
+    }
+	
+    if (level)
+	libreiserfs_free(level);
+	
+    if (*count > 0)
+	qsort(*leaves, *count, sizeof(**leaves), reiserfs_tree_blk_comp);
+	
+    return 1;
+	
+error_free_node:
+    reiserfs_block_free(node);
+error_free_next:
+    if (next)
+	libreiserfs_free(next);
+	
+    libreiserfs_free(level);
+	
+    if (*leaves)
+	libreiserfs_free(*leaves);
+	
+    *leaves = NULL;
+    *count = 0;
+	
+    return 0;
+}
+
 void reiserfs_tree_set_offset(reiserfs_tree_t *tree, long offset) {
     ASSERT(tree != NULL, return);
 	
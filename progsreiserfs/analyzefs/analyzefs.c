@@ -0,0 +1,383 @@
+/*
+    analyzefs.c -- reiserfs tree shape and fragmentation analyzer.
+    Copyright (C) 2001, 2002 Yury Umanets <torque@ukrpost.net>, see COPYING for
+    licensing and copyright details.
+*/
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+
+#include "getopt.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <dal/file.h>
+
+#include <reiserfs/reiserfs.h>
+#include <reiserfs/libprogs_tools.h>
+
+#if ENABLE_NLS
+#  include <locale.h>
+#  include <libintl.h>
+#  define _(String) dgettext (PACKAGE, String)
+#else
+#  define _(String) (String)
+#endif
+
+#define FILL_BUCKETS 	10
+#define ITEM_TYPES 	(KEY_TYPE_DR + 2)
+
+struct analyzefs_stat {
+    uint32_t blocksize;
+
+    /* Tree shape */
+    count_t nodes[MAX_HEIGHT + 1];
+    uint64_t used[MAX_HEIGHT + 1];
+    count_t fill[MAX_HEIGHT + 1][FILL_BUCKETS];
+
+    /* Item type mix. The last slot is for unknown items */
+    count_t items[ITEM_TYPES];
+    uint64_t item_bytes[ITEM_TYPES];
+
+    /* Distance between logically adjacent leaves */
+    blk_t last_leaf;
+    count_t leaf_pairs;
+    count_t leaf_seq;
+    count_t leaf_back;
+    uint64_t leaf_dist;
+
+    /* Unformatted block runs of indirect items */
+    uint32_t last_dirid, last_objid;
+    blk_t last_unfm;
+    count_t files;
+    count_t unfm_blocks;
+    count_t unfm_holes;
+    count_t unfm_runs;
+    count_t unfm_pairs;
+    count_t unfm_seq;
+    count_t unfm_gaps;
+    uint64_t unfm_gap;
+};
+
+typedef struct analyzefs_stat analyzefs_stat_t;
+
+static const char *item_names[ITEM_TYPES] = {
+    "stat_data", "indirect", "direct", "direntry", "unknown"
+};
+
+static void analyzefs_print_usage(void) {
+    fprintf(stderr, _("Usage: analyzefs.reiserfs [ options ] device\n"
+	"Options:\n"
+	"  -v | --version                  prints current version\n"
+	"  -u | --usage                    prints program usage\n"
+	"  -j | --json                     prints report in JSON format\n"));
+}
+
+static blk_t analyzefs_distance(blk_t from, blk_t to) {
+    return (to > from ? to - from : from - to);
+}
+
+static double analyzefs_percent(uint64_t part, uint64_t total) {
+    return (total ? (double)part * 100 / total : 0);
+}
+
+static double analyzefs_average(uint64_t sum, uint64_t count) {
+    return (count ? (double)sum / count : 0);
+}
+
+static void analyzefs_leaf_locality(analyzefs_stat_t *stat, blk_t blk) {
+    if (stat->last_leaf) {
+	stat->leaf_pairs++;
+	stat->leaf_dist += analyzefs_distance(stat->last_leaf, blk);
+
+	if (blk == stat->last_leaf + 1)
+	    stat->leaf_seq++;
+	else if (blk < stat->last_leaf)
+	    stat->leaf_back++;
+    }
+    stat->last_leaf = blk;
+}
+
+static void analyzefs_indirect_locality(analyzefs_stat_t *stat,
+    reiserfs_block_t *node, reiserfs_item_head_t *item)
+{
+    uint32_t i, *blocks;
+
+    /* Indirect items of the same file may follow each other */
+    if (get_key_dirid(&item->ih_key) != stat->last_dirid ||
+	get_key_objid(&item->ih_key) != stat->last_objid)
+    {
+	stat->files++;
+	stat->last_unfm = 0;
+	stat->last_dirid = get_key_dirid(&item->ih_key);
+	stat->last_objid = get_key_objid(&item->ih_key);
+    }
+
+    blocks = (uint32_t *)get_ih_item_body(node, item);
+
+    for (i = 0; i < get_ih_unfm_nr(item); i++) {
+	blk_t blk = LE32_TO_CPU(blocks[i]);
+
+	if (blk == 0) {
+	    stat->unfm_holes++;
+	    continue;
+	}
+
+	stat->unfm_blocks++;
+
+	/* Pairs of adjacent data blocks of the same file */
+	if (stat->last_unfm) {
+	    stat->unfm_pairs++;
+
+	    if (blk == stat->last_unfm + 1)
+		stat->unfm_seq++;
+	}
+
+	if (!stat->last_unfm || blk != stat->last_unfm + 1) {
+	    stat->unfm_runs++;
+
+	    if (stat->last_unfm) {
+		stat->unfm_gaps++;
+		stat->unfm_gap += analyzefs_distance(stat->last_unfm, blk);
+	    }
+	}
+	stat->last_unfm = blk;
+    }
+}
+
+static long callback_node_analyze(reiserfs_block_t *node, void *data) {
+    uint32_t i, level, used, bucket;
+    analyzefs_stat_t *stat = (analyzefs_stat_t *)data;
+
+    level = get_node_level(get_node_head(node));
+    used = MAX_CHILD_SIZE(stat->blocksize) - get_node_free_space(get_node_head(node));
+
+    if ((bucket = used * FILL_BUCKETS / MAX_CHILD_SIZE(stat->blocksize)) >= FILL_BUCKETS)
+	bucket = FILL_BUCKETS - 1;
+
+    stat->nodes[level]++;
+    stat->used[level] += used;
+    stat->fill[level][bucket]++;
+
+    if (!is_leaf_node(node))
+	return 1;
+
+    /* Traverse visits leaves in key order, so neighbours are logical ones */
+    analyzefs_leaf_locality(stat, reiserfs_block_get_nr(node));
+
+    for (i = 0; i < get_node_nritems(get_node_head(node)); i++) {
+	uint32_t type;
+	reiserfs_item_head_t *item = get_ih_item_head(node, i);
+
+	if ((type = reiserfs_key_type(&item->ih_key)) > KEY_TYPE_DR)
+	    type = ITEM_TYPES - 1;
+
+	stat->items[type]++;
+	stat->item_bytes[type] += IH_SIZE + get_ih_item_len(item);
+
+	if (type == KEY_TYPE_IT)
+	    analyzefs_indirect_locality(stat, node, item);
+    }
+
+    return 1;
+}
+
+/* Levels are counted in arrays of MAX_HEIGHT + 1 slots */
+static uint32_t analyzefs_levels(reiserfs_tree_t *tree) {
+    uint32_t height = reiserfs_tree_get_height(tree);
+    return (height > MAX_HEIGHT + 1 ? MAX_HEIGHT + 1 : height);
+}
+
+static void analyzefs_print_human(reiserfs_fs_t *fs, analyzefs_stat_t *stat) {
+    uint32_t level, i, height;
+    reiserfs_tree_t *tree = reiserfs_fs_tree(fs);
+
+    height = reiserfs_tree_get_height(tree);
+
+    printf(_("Tree height:          %u\n"), height);
+    printf(_("Root block:           %lu\n\n"), reiserfs_tree_get_root(tree));
+
+    printf(_("Level  Nodes      Fill    Fill histogram (10%% steps)\n"));
+    height = analyzefs_levels(tree);
+
+    for (level = height; level-- > LEAF_LEVEL; ) {
+	printf("%-6u %-10lu %5.1f%%  ", level, stat->nodes[level],
+	    analyzefs_percent(stat->used[level], (uint64_t)stat->nodes[level] *
+	    MAX_CHILD_SIZE(stat->blocksize)));
+
+	for (i = 0; i < FILL_BUCKETS; i++)
+	    printf("%lu%s", stat->fill[level][i], i < FILL_BUCKETS - 1 ? " " : "\n");
+    }
+
+    printf(_("\nItem type  Count      Bytes\n"));
+    for (i = 0; i < ITEM_TYPES; i++) {
+	printf("%-10s %-10lu %llu\n", item_names[i], stat->items[i],
+	    (unsigned long long)stat->item_bytes[i]);
+    }
+
+    printf(_("\nLeaf locality:        %.1f%% sequential, %.1f%% backward, "
+	"%.1f blocks average distance\n"),
+	analyzefs_percent(stat->leaf_seq, stat->leaf_pairs),
+	analyzefs_percent(stat->leaf_back, stat->leaf_pairs),
+	analyzefs_average(stat->leaf_dist, stat->leaf_pairs));
+
+    printf(_("Indirect locality:    %lu files, %lu blocks, %lu holes, %lu extents, "
+	"%.1f blocks per extent\n"), stat->files, stat->unfm_blocks,
+	stat->unfm_holes, stat->unfm_runs,
+	analyzefs_average(stat->unfm_blocks, stat->unfm_runs));
+
+    printf(_("                      %.1f%% contiguous, %.1f blocks average gap\n"),
+	analyzefs_percent(stat->unfm_seq, stat->unfm_pairs),
+	analyzefs_average(stat->unfm_gap, stat->unfm_gaps));
+}
+
+static void analyzefs_print_json(reiserfs_fs_t *fs, analyzefs_stat_t *stat) {
+    uint32_t level, i, height;
+    reiserfs_tree_t *tree = reiserfs_fs_tree(fs);
+
+    height = reiserfs_tree_get_height(tree);
+
+    printf("{\n  \"blocksize\": %u,\n  \"height\": %u,\n  \"root\": %lu,\n",
+	stat->blocksize, height, reiserfs_tree_get_root(tree));
+
+    height = analyzefs_levels(tree);
+
+    printf("  \"levels\": [\n");
+    for (level = LEAF_LEVEL; level < height; level++) {
+	printf("    {\"level\": %u, \"nodes\": %lu, \"fill\": %.2f, \"histogram\": [",
+	    level, stat->nodes[level], analyzefs_percent(stat->used[level],
+	    (uint64_t)stat->nodes[level] * MAX_CHILD_SIZE(stat->blocksize)));
+
+	for (i = 0; i < FILL_BUCKETS; i++)
+	    printf("%lu%s", stat->fill[level][i], i < FILL_BUCKETS - 1 ? ", " : "");
+
+	printf("]}%s\n", level < height - 1 ? "," : "");
+    }
+    printf("  ],\n");
+
+    printf("  \"items\": {\n");
+    for (i = 0; i < ITEM_TYPES; i++) {
+	printf("    \"%s\": {\"count\": %lu, \"bytes\": %llu}%s\n", item_names[i],
+	    stat->items[i], (unsigned long long)stat->item_bytes[i],
+	    i < ITEM_TYPES - 1 ? "," : "");
+    }
+    printf("  },\n");
+
+    printf("  \"leaf_locality\": {\"pairs\": %lu, \"sequential\": %.2f, "
+	"\"backward\": %.2f, \"distance\": %.2f},\n", stat->leaf_pairs,
+	analyzefs_percent(stat->leaf_seq, stat->leaf_pairs),
+	analyzefs_percent(stat->leaf_back, stat->leaf_pairs),
+	analyzefs_average(stat->leaf_dist, stat->leaf_pairs));
+
+    printf("  \"indirect_locality\": {\"files\": %lu, \"blocks\": %lu, \"holes\": %lu, "
+	"\"extents\": %lu, \"extent_length\": %.2f, \"contiguous\": %.2f, "
+	"\"gap\": %.2f}\n}\n", stat->files, stat->unfm_blocks, stat->unfm_holes,
+	stat->unfm_runs, analyzefs_average(stat->unfm_blocks, stat->unfm_runs),
+	analyzefs_percent(stat->unfm_seq, stat->unfm_pairs),
+	analyzefs_average(stat->unfm_gap, stat->unfm_gaps));
+}
+
+int main(int argc, char *argv[]) {
+    int choice, json = 0;
+
+    char *host_dev;
+    dal_t *host_dal;
+    reiserfs_fs_t *fs;
+    analyzefs_stat_t stat;
+
+    static struct option long_options[] = {
+	{"version", no_argument, NULL, 'v'},
+	{"usage", no_argument, NULL, 'u'},
+	{"json", no_argument, NULL, 'j'},
+	{0, 0, 0, 0}
+    };
+
+#ifdef ENABLE_NLS
+    setlocale(LC_ALL, "");
+    bindtextdomain(PACKAGE, LOCALEDIR);
+    textdomain(PACKAGE);
+#endif
+
+    while ((choice = getopt_long_only(argc, argv, "uvj", long_options,
+	(int *)0)) != EOF)
+    {
+	switch (choice) {
+	    case 'u': {
+		analyzefs_print_usage();
+		return 0;
+	    }
+	    case 'v': {
+		printf("%s %s\n", argv[0], VERSION);
+		return 0;
+	    }
+	    case 'j': {
+		json = 1;
+		break;
+	    }
+	    case '?': {
+		analyzefs_print_usage();
+		return 0xfe;
+	    }
+	}
+    }
+
+    if (optind >= argc) {
+	analyzefs_print_usage();
+	return 0xfe;
+    }
+
+    host_dev = argv[optind];
+
+    /* Checking given device for validness */
+    if (!progs_dev_check(host_dev)) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL,
+	    _("Device %s doesn't exists or invalid."), host_dev);
+	return 0xfe;
+    }
+
+    /* Creating device abstraction layer */
+    if (!(host_dal = file_open(host_dev, DEFAULT_BLOCK_SIZE, O_RDONLY))) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL,
+	    _("Couldn't open device %s. %s."), host_dev, strerror(errno));
+	goto error;
+    }
+
+    /* Neither journal nor bitmap are needed for tree analysis */
+    if (!(fs = reiserfs_fs_open_fast(host_dal, NULL))) {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL,
+	    _("Couldn't open reiserfs on device %s."), host_dev);
+	goto error_free_host_dal;
+    }
+
+    memset(&stat, 0, sizeof(stat));
+    stat.blocksize = reiserfs_fs_block_size(fs);
+
+    if (!reiserfs_tree_simple_traverse(reiserfs_fs_tree(fs), &stat,
+	    callback_node_analyze))
+    {
+	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL,
+	    _("Couldn't traverse the tree on device %s."), host_dev);
+	goto error_free_fs;
+    }
+
+    if (json)
+	analyzefs_print_json(fs, &stat);
+    else
+	analyzefs_print_human(fs, &stat);
+
+    reiserfs_fs_close(fs);
+    file_close(host_dal);
+
+    return 0;
+
+error_free_fs:
+    reiserfs_fs_close(fs);
+error_free_host_dal:
+    file_close(host_dal);
+error:
+    return 0xff;
+}
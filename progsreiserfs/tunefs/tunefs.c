@@ -211,7 +211,7 @@ int main(int argc, char *argv[]) {
 	}
     }
 
-    if (!(fs = reiserfs_fs_open(host_dal, (!journal ? NULL : 
+    if (!(fs = reiserfs_fs_open_lazy(host_dal, (!journal ? NULL : 
 	(journal_dal ? journal_dal : host_dal))))) 
     {
 	libreiserfs_exception_throw(EXCEPTION_ERROR, EXCEPTION_CANCEL, 